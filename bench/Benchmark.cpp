@@ -0,0 +1,512 @@
+#include "../src/LinearQuadTree.h"
+#include "../src/QuadTree.h"
+#include "../src/SmartPoolAllocator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+Headless benchmark of the quad tree and of the linear quad tree, every measurement is printed as one JSON object per line so runs can be diffed and compared by scripts.
+Usage: quadtree_bench [--elements N] [--queries N] [--ticks N] [--seed N] [--quick]
+REMARK: Insert, Move and Remove are timed in batches of batch_size operations, their percentiles are those of the per operation average of each batch
+REMARK: Runs with the pool allocator also report the bytes the tree holds once every element is in, the standard allocator can't tell
+*/
+
+//////////////////////////////////////////////////////////////////////////
+
+struct Item
+{
+        vec2 position;
+        unsigned int id;
+
+        const vec2& Position() const
+        {
+                return position;
+        }
+
+        void Position(const vec2& pos)
+        {
+                position = pos;
+        }
+};
+
+struct Config
+{
+        size_t elements = 100000;
+        size_t queries = 10000;
+        size_t ticks = 10;
+        unsigned int seed = 1;
+};
+
+struct Dataset
+{
+        const char* name;
+        std::vector<Item> items;
+        std::vector<vec2> velocities; // applied once per tick by the move workloads
+};
+
+using clock_type = std::chrono::steady_clock;
+
+static const float world = 1000.0f;
+static const float query_extent = 20.0f; // half width of the query boxes
+static const float pair_distance = 5.0f; // of the broad phase self-join
+static const size_t batch_size = 256;
+static const size_t linear_updates = 4096; // every linear Insert and Remove shifts the arrays, only that many are timed
+
+static double elapsed_ns(clock_type::time_point start)
+{
+        return std::chrono::duration<double, std::nano>(clock_type::now() - start).count();
+}
+
+static float clamp_world(float value)
+{
+        return std::min(std::max(value, 0.0f), world);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Uniformly scattered, slowly jittering elements
+static Dataset uniform(const Config& config, std::mt19937& rng)
+{
+        std::uniform_real_distribution<float> position(0.0f, world);
+        std::uniform_real_distribution<float> jitter(-1.0f, 1.0f);
+
+        Dataset data;
+        data.name = "uniform";
+        for (unsigned int k = 0; k < config.elements; ++k)
+        {
+                data.items.push_back(Item{vec2(position(rng), position(rng)), k});
+                data.velocities.push_back(vec2(jitter(rng), jitter(rng)));
+        }
+        return data;
+}
+
+// A few dense gaussian clusters, the elements wander around their cluster
+static Dataset clustered(const Config& config, std::mt19937& rng)
+{
+        std::uniform_real_distribution<float> position(100.0f, world - 100.0f);
+        std::normal_distribution<float> spread(0.0f, 25.0f);
+        std::uniform_real_distribution<float> jitter(-1.0f, 1.0f);
+
+        std::vector<vec2> centers;
+        for (size_t k = 0; k < 16; ++k) centers.push_back(vec2(position(rng), position(rng)));
+
+        Dataset data;
+        data.name = "clustered";
+        for (unsigned int k = 0; k < config.elements; ++k)
+        {
+                const vec2& center = centers[k % centers.size()];
+                data.items.push_back(Item{vec2(clamp_world(center.x + spread(rng)), clamp_world(center.y + spread(rng))), k});
+                data.velocities.push_back(vec2(jitter(rng), jitter(rng)));
+        }
+        return data;
+}
+
+// Crowds streaming across the world in a few shared directions, most elements cross node boundaries every tick
+static Dataset moving(const Config& config, std::mt19937& rng)
+{
+        std::uniform_real_distribution<float> position(0.0f, world);
+        std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+        std::normal_distribution<float> noise(0.0f, 0.5f);
+
+        std::vector<vec2> headings;
+        for (size_t k = 0; k < 4; ++k)
+        {
+                float a = angle(rng);
+                headings.push_back(vec2(8.0f * std::cos(a), 8.0f * std::sin(a)));
+        }
+
+        Dataset data;
+        data.name = "moving";
+        for (unsigned int k = 0; k < config.elements; ++k)
+        {
+                const vec2& heading = headings[k % headings.size()];
+                data.items.push_back(Item{vec2(position(rng), position(rng)), k});
+                data.velocities.push_back(vec2(heading.x + noise(rng), heading.y + noise(rng)));
+        }
+        return data;
+}
+
+// Elements bounce off the borders of the world so the region never has to grow
+static vec2 step(const vec2& position, vec2& velocity)
+{
+        vec2 next = position + velocity;
+        if (next.x < 0.0f || next.x > world) velocity.x = -velocity.x;
+        if (next.y < 0.0f || next.y > world) velocity.y = -velocity.y;
+        return vec2(clamp_world(next.x), clamp_world(next.y));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+struct Run
+{
+        const char* tree;
+        const char* distribution;
+        const char* allocator;
+        size_t capacity;
+        size_t elements;
+};
+
+// Prints one measurement, samples are nanoseconds per operation and get sorted
+static void report(const Run& run, const char* workload, size_t operations, double total_ns, std::vector<double>& samples, double extra = -1.0)
+{
+        std::sort(samples.begin(), samples.end());
+        auto percentile = [&samples](double p) -> double
+        {
+                if (samples.empty()) return 0.0;
+                size_t index = static_cast<size_t>(p * (samples.size() - 1) + 0.5);
+                return samples[index];
+        };
+
+        // %llu rather than %zu, Visual Studio 2013 doesn't know the latter
+        std::printf("{\"workload\":\"%s\",\"tree\":\"%s\",\"distribution\":\"%s\",\"allocator\":\"%s\",\"capacity\":%llu,\"elements\":%llu,"
+                    "\"operations\":%llu,\"ops_per_sec\":%.1f,\"p50_ns\":%.1f,\"p90_ns\":%.1f,\"p99_ns\":%.1f,\"max_ns\":%.1f",
+                    workload, run.tree, run.distribution, run.allocator, (unsigned long long) run.capacity, (unsigned long long) run.elements,
+                    (unsigned long long) operations, total_ns > 0.0 ? operations * 1e9 / total_ns : 0.0,
+                    percentile(0.5), percentile(0.9), percentile(0.99), samples.empty() ? 0.0 : samples.back());
+        if (extra >= 0.0) std::printf(",\"results_per_query\":%.2f", extra);
+        std::printf("}\n");
+        std::fflush(stdout);
+}
+
+static size_t pool_bytes(const std::allocator<Item>&)
+{
+        return 0;
+}
+
+static size_t pool_bytes(const orc::SmartPoolAllocator<Item>& allocator)
+{
+        return allocator.Stats().bytes_in_use;
+}
+
+// Prints the bytes the tree holds through the pool, nothing for the standard allocator
+template <typename allocator_type>
+static void report_memory(const Run& run, const allocator_type& allocator)
+{
+        const size_t bytes = pool_bytes(allocator);
+        if (bytes == 0) return;
+        std::printf("{\"workload\":\"memory\",\"tree\":\"%s\",\"distribution\":\"%s\",\"allocator\":\"%s\",\"capacity\":%llu,\"elements\":%llu,"
+                    "\"bytes\":%llu,\"bytes_per_element\":%.2f}\n",
+                    run.tree, run.distribution, run.allocator, (unsigned long long) run.capacity, (unsigned long long) run.elements,
+                    (unsigned long long) bytes, double(bytes) / run.elements);
+        std::fflush(stdout);
+}
+
+template <typename allocator_type>
+static void benchmark(const Config& config, const Dataset& data, const char* allocator_name, allocator_type& allocator, size_t capacity)
+{
+        using tree_type = orc::QuadTree<Item, allocator_type>;
+        const orc::AABB region(vec2(0.0f, 0.0f), vec2(world, world));
+        const size_t count = data.items.size();
+        const Run run = {"pointer", data.name, allocator_name, capacity, count};
+        std::vector<double> samples;
+
+        // Bulk build, a single sample
+        {
+                clock_type::time_point start = clock_type::now();
+                tree_type tree(data.items.begin(), data.items.end(), allocator, capacity);
+                double total = elapsed_ns(start);
+                samples.assign(1, total / count);
+                report(run, "build", count, total, samples);
+        }
+
+        tree_type tree(region, allocator, capacity);
+        std::vector<orc::QuadTreeHandle> handles(count);
+
+        // Insert
+        {
+                samples.clear();
+                double total = 0.0;
+                for (size_t first = 0; first < count; first += batch_size)
+                {
+                        size_t last = std::min(first + batch_size, count);
+                        clock_type::time_point start = clock_type::now();
+                        for (size_t k = first; k < last; ++k) handles[k] = tree.Insert(data.items[k]);
+                        double batch = elapsed_ns(start);
+                        total += batch;
+                        samples.push_back(batch / (last - first));
+                }
+                report(run, "insert", count, total, samples);
+        }
+        report_memory(run, allocator);
+
+        // Query, boxes centered on elements so clustered data is queried where it's dense
+        {
+                std::mt19937 rng(config.seed);
+                std::uniform_int_distribution<size_t> pick(0, count - 1);
+                std::vector<Item*> results;
+                samples.clear();
+                double total = 0.0;
+                size_t found = 0;
+                for (size_t k = 0; k < config.queries; ++k)
+                {
+                        const vec2& center = data.items[pick(rng)].position;
+                        orc::AABB box(center - vec2(query_extent, query_extent), center + vec2(query_extent, query_extent));
+
+                        results.clear();
+                        clock_type::time_point start = clock_type::now();
+                        tree.Query(box, std::back_inserter(results));
+                        double sample = elapsed_ns(start);
+                        total += sample;
+                        samples.push_back(sample);
+                        found += results.size();
+                }
+                report(run, "query", config.queries, total, samples, config.queries ? double(found) / config.queries : 0.0);
+        }
+
+        // Broad phase self-join, once per tick
+        {
+                samples.clear();
+                double total = 0.0;
+                size_t found = 0;
+                for (size_t tick = 0; tick < config.ticks; ++tick)
+                {
+                        clock_type::time_point start = clock_type::now();
+                        tree.ForEachPairWithin(pair_distance, [&found](Item&, Item&) { ++found; });
+                        double sample = elapsed_ns(start);
+                        total += sample;
+                        samples.push_back(sample);
+                }
+                report(run, "pairs", config.ticks, total, samples, config.ticks ? double(found) / config.ticks : 0.0);
+        }
+
+        // Move, one element at a time and then batched through MoveAll
+        {
+                std::vector<vec2> positions(count), velocities(data.velocities);
+                for (size_t k = 0; k < count; ++k) positions[k] = data.items[k].position;
+
+                samples.clear();
+                double total = 0.0;
+                for (size_t tick = 0; tick < config.ticks; ++tick)
+                {
+                        for (size_t k = 0; k < count; ++k) positions[k] = step(positions[k], velocities[k]);
+                        for (size_t first = 0; first < count; first += batch_size)
+                        {
+                                size_t last = std::min(first + batch_size, count);
+                                clock_type::time_point start = clock_type::now();
+                                for (size_t k = first; k < last; ++k) tree.Move(handles[k], positions[k]);
+                                double batch = elapsed_ns(start);
+                                total += batch;
+                                samples.push_back(batch / (last - first));
+                        }
+                }
+                report(run, "move", count * config.ticks, total, samples);
+
+                samples.clear();
+                total = 0.0;
+                for (size_t tick = 0; tick < config.ticks; ++tick)
+                {
+                        for (size_t k = 0; k < count; ++k) positions[k] = step(positions[k], velocities[k]);
+                        clock_type::time_point start = clock_type::now();
+                        tree.MoveAll(handles.data(), positions.data(), count);
+                        double sample = elapsed_ns(start);
+                        total += sample;
+                        samples.push_back(sample / count);
+                }
+                report(run, "move_all", count * config.ticks, total, samples);
+        }
+
+        // Remove in random order
+        {
+                std::mt19937 rng(config.seed);
+                std::shuffle(handles.begin(), handles.end(), rng);
+                samples.clear();
+                double total = 0.0;
+                for (size_t first = 0; first < count; first += batch_size)
+                {
+                        size_t last = std::min(first + batch_size, count);
+                        clock_type::time_point start = clock_type::now();
+                        for (size_t k = first; k < last; ++k) tree.Remove(handles[k]);
+                        double batch = elapsed_ns(start);
+                        total += batch;
+                        samples.push_back(batch / (last - first));
+                }
+                report(run, "remove", count, total, samples);
+        }
+}
+
+// Same workloads over the linear tree, which has no handles: elements are found again through a query around their last position
+template <typename allocator_type>
+static void benchmark_linear(const Config& config, const Dataset& data, const char* allocator_name, allocator_type& allocator, size_t capacity)
+{
+        using tree_type = orc::LinearQuadTree<Item, allocator_type>;
+        const size_t count = data.items.size();
+        const Run run = {"linear", data.name, allocator_name, capacity, count};
+        std::vector<double> samples;
+
+        tree_type tree(orc::AABB(vec2(0.0f, 0.0f), vec2(world, world)), allocator, capacity);
+        auto locate = [&tree](const vec2& position, unsigned int id) -> Item*
+        {
+                for (Item* item : tree.Query(orc::AABB(position, position)))
+                {
+                        if (item->id == id) return item;
+                }
+                return nullptr;
+        };
+
+        // Bulk build, a single sample
+        {
+                clock_type::time_point start = clock_type::now();
+                tree.Build(data.items.begin(), data.items.end());
+                double total = elapsed_ns(start);
+                samples.assign(1, total / count);
+                report(run, "build", count, total, samples);
+        }
+        report_memory(run, allocator);
+
+        // Query, the same boxes as the pointer tree's
+        {
+                std::mt19937 rng(config.seed);
+                std::uniform_int_distribution<size_t> pick(0, count - 1);
+                samples.clear();
+                double total = 0.0;
+                size_t found = 0;
+                for (size_t k = 0; k < config.queries; ++k)
+                {
+                        const vec2& center = data.items[pick(rng)].position;
+                        orc::AABB box(center - vec2(query_extent, query_extent), center + vec2(query_extent, query_extent));
+
+                        clock_type::time_point start = clock_type::now();
+                        std::vector<Item*> results = tree.Query(box);
+                        double sample = elapsed_ns(start);
+                        total += sample;
+                        samples.push_back(sample);
+                        found += results.size();
+                }
+                report(run, "query", config.queries, total, samples, config.queries ? double(found) / config.queries : 0.0);
+        }
+
+        // Move, locating each element is part of the cost
+        {
+                std::vector<vec2> positions(count), velocities(data.velocities);
+                for (size_t k = 0; k < count; ++k) positions[k] = data.items[k].position;
+
+                samples.clear();
+                double total = 0.0;
+                for (size_t tick = 0; tick < config.ticks; ++tick)
+                {
+                        for (size_t first = 0; first < count; first += batch_size)
+                        {
+                                size_t last = std::min(first + batch_size, count);
+                                clock_type::time_point start = clock_type::now();
+                                for (size_t k = first; k < last; ++k)
+                                {
+                                        vec2 next = step(positions[k], velocities[k]);
+                                        tree.Move(locate(positions[k], data.items[k].id), next);
+                                        positions[k] = next;
+                                }
+                                double batch = elapsed_ns(start);
+                                total += batch;
+                                samples.push_back(batch / (last - first));
+                        }
+                }
+                report(run, "move", count * config.ticks, total, samples);
+        }
+
+        // Insert then remove a bounded number of extra elements, in random order
+        {
+                const size_t updates = std::min(count, linear_updates);
+                std::vector<Item> extra(data.items.begin(), data.items.begin() + updates);
+                for (size_t k = 0; k < updates; ++k) extra[k].id = static_cast<unsigned int>(count + k);
+
+                samples.clear();
+                double total = 0.0;
+                for (size_t first = 0; first < updates; first += batch_size)
+                {
+                        size_t last = std::min(first + batch_size, updates);
+                        clock_type::time_point start = clock_type::now();
+                        for (size_t k = first; k < last; ++k) tree.Insert(extra[k]);
+                        double batch = elapsed_ns(start);
+                        total += batch;
+                        samples.push_back(batch / (last - first));
+                }
+                report(run, "insert", updates, total, samples);
+
+                std::mt19937 rng(config.seed);
+                std::shuffle(extra.begin(), extra.end(), rng);
+                samples.clear();
+                total = 0.0;
+                for (size_t first = 0; first < updates; first += batch_size)
+                {
+                        size_t last = std::min(first + batch_size, updates);
+                        clock_type::time_point start = clock_type::now();
+                        for (size_t k = first; k < last; ++k) tree.Remove(locate(extra[k].position, extra[k].id));
+                        double batch = elapsed_ns(start);
+                        total += batch;
+                        samples.push_back(batch / (last - first));
+                }
+                report(run, "remove", updates, total, samples);
+        }
+}
+
+int main(int argc, char** argv)
+{
+        Config config;
+        for (int k = 1; k < argc; ++k)
+        {
+                std::string arg = argv[k];
+                bool has_value = k + 1 < argc;
+                if (arg == "--quick")
+                {
+                        config.elements = 5000;
+                        config.queries = 500;
+                        config.ticks = 2;
+                }
+                else if (arg == "--elements" && has_value) config.elements = std::strtoul(argv[++k], nullptr, 10);
+                else if (arg == "--queries" && has_value) config.queries = std::strtoul(argv[++k], nullptr, 10);
+                else if (arg == "--ticks" && has_value) config.ticks = std::strtoul(argv[++k], nullptr, 10);
+                else if (arg == "--seed" && has_value) config.seed = static_cast<unsigned int>(std::strtoul(argv[++k], nullptr, 10));
+                else
+                {
+                        std::fprintf(stderr, "usage: %s [--elements N] [--queries N] [--ticks N] [--seed N] [--quick]\n", argv[0]);
+                        return 1;
+                }
+        }
+        if (config.elements == 0)
+        {
+                std::fprintf(stderr, "--elements must be positive\n");
+                return 1;
+        }
+
+        std::mt19937 rng(config.seed);
+        std::vector<Dataset> datasets;
+        datasets.push_back(uniform(config, rng));
+        datasets.push_back(clustered(config, rng));
+        datasets.push_back(moving(config, rng));
+
+        const size_t capacities[] = {4, 8, 16, 32};
+        for (const Dataset& data : datasets)
+        {
+                for (size_t capacity : capacities)
+                {
+                        std::allocator<Item> standard;
+                        benchmark(config, data, "std", standard, capacity);
+                        benchmark_linear(config, data, "std", standard, capacity);
+
+                        // A fresh pool per run, sized small enough that chaining is exercised on large runs
+                        orc::MemoryPool* pool = orc::MakeMemoryPool(config.elements * 64);
+                        {
+                                orc::SmartPoolAllocator<Item> pooled(pool);
+                                benchmark(config, data, "pool", pooled, capacity);
+                        }
+                        orc::DestroyMemoryPool(pool);
+
+                        pool = orc::MakeMemoryPool(config.elements * 64);
+                        {
+                                orc::SmartPoolAllocator<Item> pooled(pool);
+                                benchmark_linear(config, data, "pool", pooled, capacity);
+                        }
+                        orc::DestroyMemoryPool(pool);
+                }
+        }
+
+        return 0;
+}
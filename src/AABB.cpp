@@ -37,6 +37,14 @@ namespace ORC_NAMESPACE
                          sw.y > other.ne.y );
         }
 
+        bool AABB::Contains(const AABB& other) const
+        {
+                return other.sw.x >= sw.x &&
+                       other.ne.x <= ne.x &&
+                       other.sw.y >= sw.y &&
+                       other.ne.y <= ne.y;
+        }
+
         bool AABB::Inside(const vec2& point) const
         {
                 return point.x >= sw.x &&
@@ -45,6 +53,20 @@ namespace ORC_NAMESPACE
                        point.y <= ne.y;
         }
 
+        float AABB::DistanceSquared(const vec2& point) const
+        {
+                float dx = max(max(sw.x - point.x, point.x - ne.x), 0.0f);
+                float dy = max(max(sw.y - point.y, point.y - ne.y), 0.0f);
+                return dx * dx + dy * dy;
+        }
+
+        float AABB::DistanceSquared(const AABB& other) const
+        {
+                float dx = max(max(sw.x - other.ne.x, other.sw.x - ne.x), 0.0f);
+                float dy = max(max(sw.y - other.ne.y, other.sw.y - ne.y), 0.0f);
+                return dx * dx + dy * dy;
+        }
+
         void AABB::Render(unsigned int* buffer, unsigned int color) const
         {
 
@@ -104,6 +126,12 @@ namespace ORC_NAMESPACE
                 return (ne + sw) * 0.5f;
         }
 
+        AABB AABB::Quadrant(unsigned int index) const
+        {
+                vec2 corner(index & 2 ? ne.x : sw.x, index & 1 ? ne.y : sw.y);
+                return AABB(corner, Center());
+        }
+
 
         void util::Render(const vec2& point, unsigned int* buffer, unsigned int color)
         {
@@ -119,4 +147,18 @@ namespace ORC_NAMESPACE
                 }
         }
 
+        unsigned int util::MortonKey(const AABB& region, const vec2& point, unsigned int levels)
+        {
+                unsigned int key = 0;
+                AABB current = region;
+                for (unsigned int k = 0; k < levels; ++k)
+                {
+                        vec2 center = current.Center();
+                        unsigned int index = ((point.x > center.x) << 1) | (point.y > center.y);
+                        key = (key << 2) | index;
+                        current = current.Quadrant(index);
+                }
+                return key;
+        }
+
 };
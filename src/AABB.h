@@ -21,8 +21,14 @@ namespace ORC_NAMESPACE
                 AABB(const vec2& sw, const vec2& ne);
                 
                 bool Intersect(const AABB& other) const;
+                bool Contains(const AABB& other) const;
                 bool Inside(const vec2& point) const;
 
+                // Squared distance from the point to the closest point of the box, zero if inside
+                float DistanceSquared(const vec2& point) const;
+                // Squared distance between the closest points of the two boxes, zero if they intersect
+                float DistanceSquared(const AABB& other) const;
+
                 void Render(unsigned int* buffer, unsigned int color) const;
 
                 vec2 BottomLeft() const;
@@ -31,11 +37,20 @@ namespace ORC_NAMESPACE
                 vec2 TopRight() const;
                 vec2 Center() const;
 
+                // Sub quadrant using the quad tree layout: bit 1 is set for the east half, bit 0 for the north half
+                AABB Quadrant(unsigned int index) const;
+
         };
 
         namespace util
         {
                 void Render(const vec2& point, unsigned int* buffer, unsigned int color);
+
+                /*
+                Description: computes the Z-order (Morton) key of a point by descending through the quadrants of the region
+                Remark: quadrant boundaries are computed exactly like the quad tree computes them, so sorting by this key groups points by node
+                */
+                unsigned int MortonKey(const AABB& region, const vec2& point, unsigned int levels);
         }
 
 };
@@ -0,0 +1,214 @@
+#ifndef _CACHING_POOL_ALLOCATOR_H
+#define _CACHING_POOL_ALLOCATOR_H
+
+#include "config.h"
+#include "SmartPoolAllocator.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+namespace ORC_NAMESPACE
+{
+        /*
+        Memory owned by a single thread: only the owner allocates from its pool, other threads hand blocks back through the remote stack
+        */
+        struct ThreadCache
+        {
+                MemoryPool* pool;
+                std::atomic<void*> remote; // blocks freed by other threads, linked through their first word
+                std::thread::id owner;
+                ThreadCache* next;
+        };
+
+        /*
+        Arena shared between threads, every thread using it gets its own ThreadCache the first time it allocates
+        */
+        struct SharedMemoryPool
+        {
+                size_t id; // never reused, so stale per-thread lookups can't match a newer arena at the same address
+                size_t chunk_size;
+                std::mutex lock; // only taken when a thread uses the arena for the first time
+                ThreadCache* caches;
+        };
+
+        // Per-thread lookup of the caches, direct mapped by arena id
+        struct CacheEntry
+        {
+                size_t arena;
+                ThreadCache* cache;
+        };
+        static const unsigned int cache_entries = 4;
+
+        inline CacheEntry* thread_cache_entries()
+        {
+                static ORC_THREAD_LOCAL CacheEntry entries[cache_entries];
+                return entries;
+        }
+
+        inline size_t next_arena_id()
+        {
+                static std::atomic<size_t> counter; // zero initialized before anything runs
+                return ++counter;
+        }
+
+        // The calling thread's cache of the arena, created on first use
+        inline ThreadCache* thread_cache(SharedMemoryPool* arena)
+        {
+                CacheEntry& entry = thread_cache_entries()[arena->id % cache_entries];
+                if (entry.arena == arena->id) return entry.cache;
+
+                std::thread::id self = std::this_thread::get_id();
+                std::lock_guard<std::mutex> guard(arena->lock);
+
+                // Thread ids of finished threads may be reused, the new thread simply adopts the old cache
+                ThreadCache* cache = arena->caches;
+                while (cache != nullptr && cache->owner != self) cache = cache->next;
+                if (cache == nullptr)
+                {
+                        cache = new ThreadCache();
+                        cache->pool = MakeMemoryPool(arena->chunk_size);
+                        cache->remote = nullptr;
+                        cache->owner = self;
+                        cache->next = arena->caches;
+                        arena->caches = cache;
+                }
+
+                entry.arena = arena->id;
+                entry.cache = cache;
+                return cache;
+        }
+
+        // Returns the blocks other threads freed to the owner's pool, only called by the owner
+        inline void drain_remote(ThreadCache* cache)
+        {
+                if (cache->remote.load(std::memory_order_relaxed) == nullptr) return;
+
+                void* block = cache->remote.exchange(nullptr, std::memory_order_acquire);
+                while (block != nullptr)
+                {
+                        void* next = *static_cast<void**>(block);
+                        pool_deallocate(cache->pool, block);
+                        block = next;
+                }
+        }
+
+        /*
+        Description: creates an arena that can be shared by allocators on any number of threads, every thread's pool starts with chunk_size bytes
+        Remark: DestroySharedMemoryPool must be called on it once nothing allocated from it is in use anymore
+        */
+        inline SharedMemoryPool* MakeSharedMemoryPool(size_t chunk_size)
+        {
+                SharedMemoryPool* arena = new SharedMemoryPool();
+                arena->id = next_arena_id();
+                arena->chunk_size = chunk_size;
+                arena->caches = nullptr;
+                return arena;
+        }
+
+        /*
+        Description: sums the counters of every thread's pool of the arena
+        Remark: the high water mark is the sum of the per-thread marks, an upper bound of the arena's actual one
+        */
+        inline PoolStats GetSharedPoolStats(SharedMemoryPool* arena)
+        {
+                PoolStats total = PoolStats();
+                std::lock_guard<std::mutex> guard(arena->lock);
+                for (ThreadCache* cache = arena->caches; cache != nullptr; cache = cache->next)
+                {
+                        PoolStats stats = GetPoolStats(cache->pool);
+                        total.bytes_in_use += stats.bytes_in_use;
+                        total.high_water += stats.high_water;
+                        total.bump_hits += stats.bump_hits;
+                        total.free_list_hits += stats.free_list_hits;
+                        total.chunk_hits += stats.chunk_hits;
+                        total.free_blocks += stats.free_blocks;
+                        for (unsigned int k = 0; k < search_buckets; ++k) total.search_lengths[k] += stats.search_lengths[k];
+                }
+                return total;
+        }
+
+        inline void DestroySharedMemoryPool(SharedMemoryPool* arena)
+        {
+                for (ThreadCache* cache = arena->caches; cache != nullptr;)
+                {
+                        ThreadCache* next = cache->next;
+                        DestroyMemoryPool(cache->pool);
+                        delete cache;
+                        cache = next;
+                }
+                delete arena;
+        }
+
+        /*
+        Thread caching variant of SmartPoolAllocator: every thread bump allocates from its own pool, so no lock is ever taken after a thread's first allocation.
+        A block freed by a thread other than the one that allocated it is pushed onto its owner's lock free remote stack and reused once the owner allocates again.
+        REMARK: Every allocation carries one more word than SmartPoolAllocator's, the owning cache
+        REMARK: Blocks freed remotely after their owner thread exited are only reclaimed when the arena is destroyed, unless a new thread adopts the same id
+        */
+        template <typename T>
+        struct CachingPoolAllocator
+        {
+                SharedMemoryPool* arena;
+
+                // Requirements for standard conformity, also allows this to work with STL containers
+                using value_type = T;
+                using propagate_on_container_move_assignment = std::true_type;
+
+                CachingPoolAllocator() throw() = delete;
+                CachingPoolAllocator(SharedMemoryPool* arena) throw() : arena(arena)
+                {}
+                template <typename U> CachingPoolAllocator(const CachingPoolAllocator<U>& o) throw() : arena(o.arena)
+                {}
+                ~CachingPoolAllocator() throw()
+                {}
+
+                T* allocate(size_t size, const void* = 0)
+                {
+                        ThreadCache* cache = thread_cache(arena);
+                        drain_remote(cache);
+
+                        void* block = pool_allocate(cache->pool, size * sizeof(T) + sizeof(ThreadCache*));
+                        *static_cast<ThreadCache**>(block) = cache;
+                        return static_cast<T*>(ptr_add(block, sizeof(ThreadCache*)));
+                }
+
+                void deallocate(T* address, size_t)
+                {
+                        void* block = static_cast<char*>(static_cast<void*>(address)) - sizeof(ThreadCache*);
+                        ThreadCache* owner = *static_cast<ThreadCache**>(block);
+
+                        if (owner->owner == std::this_thread::get_id())
+                        {
+                                pool_deallocate(owner->pool, block);
+                                return;
+                        }
+
+                        // Another thread's block, push it onto the owner's remote stack, the owner takes the whole stack at once so there's no ABA
+                        void* head = owner->remote.load(std::memory_order_relaxed);
+                        do
+                        {
+                                *static_cast<void**>(block) = head;
+                        } while (!owner->remote.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+                }
+
+                PoolStats Stats() const
+                {
+                        return GetSharedPoolStats(arena);
+                }
+
+        };
+        template<typename T, typename U>
+        bool operator==(const CachingPoolAllocator<T>& a, const CachingPoolAllocator<U>& b)
+        {
+                return a.arena == b.arena;
+        }
+        template<typename T, typename U>
+        bool operator!=(const CachingPoolAllocator<T>& a, const CachingPoolAllocator<U>& b)
+        {
+                return a.arena != b.arena;
+        }
+
+};
+
+#endif // _CACHING_POOL_ALLOCATOR_H
@@ -0,0 +1,246 @@
+#ifndef _LINEAR_QUADTREE_H
+#define _LINEAR_QUADTREE_H
+
+#include "config.h"
+#include "AABB.h"
+
+#include <memory>
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace ORC_NAMESPACE
+{
+
+        /*
+        Pointerless quad tree: every element lives in one contiguous array sorted by its Morton key, a node is the range of keys sharing its prefix.
+        Nodes are never stored, they are located with binary searches over the key array, so the only overhead is one key per element.
+        REMARK: Any modification shifts the array, pointers returned by Insert and Move are only valid until the next Insert, Move or Remove
+        REMARK: The region grows like QuadTree's does, which requires re-sorting everything, avoid adding elements outside of the region
+        */
+        template <typename type_p, typename allocator_type = std::allocator<type_p>>
+        class LinearQuadTree
+        {
+
+        protected:
+
+                static const unsigned char max_depth = 16;
+                const size_t node_capacity;
+
+                using alloc_t = std::allocator_traits < allocator_type > ;
+                using KeyAlloc = typename alloc_t::template rebind_alloc < unsigned int > ;
+                using VecAlloc = typename alloc_t::template rebind_alloc < type_p > ;
+
+                AABB region;
+                std::vector<unsigned int, KeyAlloc> keys;
+                std::vector<type_p, VecAlloc> content;
+
+                unsigned int key(const vec2& point) const
+                {
+                        return util::MortonKey(region, point, max_depth);
+                }
+
+                // Recomputes every key and restores the ordering, used after the region changes
+                void sort()
+                {
+                        std::vector<std::pair<unsigned int, size_t>> order;
+                        order.reserve(content.size());
+                        for (size_t k = 0; k < content.size(); ++k)
+                                order.emplace_back(key(content[k].Position()), k);
+                        std::sort(order.begin(), order.end());
+
+                        // The elements are permuted in place one cycle at a time, no copy of them is allocated
+                        for (size_t k = 0; k < order.size(); ++k)
+                        {
+                                keys[k] = order[k].first;
+                                if (order[k].second == k) continue;
+
+                                type_p item = content[k];
+                                size_t slot = k;
+                                for (size_t from = order[slot].second; from != k; from = order[slot].second)
+                                {
+                                        content[slot] = content[from];
+                                        order[slot].second = slot;
+                                        slot = from;
+                                }
+                                content[slot] = item;
+                                order[slot].second = slot;
+                        }
+                }
+
+                void expand(const vec2& point) // Just as slow as QuadTree's, every key has to be recomputed
+                {
+                        vec2 sw = region.BottomLeft();
+                        vec2 ne = region.TopRight();
+                        vec2 center = region.Center();
+                        vec2 extent = ne - sw;
+
+                        if (point.x > center.x) ne.x += extent.x;
+                        else sw.x -= extent.x;
+                        if (point.y > center.y) ne.y += extent.y;
+                        else sw.y -= extent.y;
+
+                        region = AABB(sw, ne);
+                        sort();
+                }
+
+                // Walks the implicit node covering [first, last) of the arrays, keys in the range share the top (2 * depth) bits of prefix
+                template <typename result_type>
+                void query(result_type& results, const AABB& query_region, const AABB& node_region,
+                           unsigned int prefix, unsigned char depth, size_t first, size_t last) const
+                {
+                        if (first == last) return;
+
+                        if (query_region.Contains(node_region)) // whole node accepted, no need to test its points
+                        {
+                                for (size_t k = first; k < last; ++k)
+                                        results.emplace_back(const_cast<type_p*>(&content[k]));
+                                return;
+                        }
+
+                        if (last - first <= node_capacity || depth == max_depth) // small enough, scan it
+                        {
+                                for (size_t k = first; k < last; ++k)
+                                {
+                                        const type_p& item = content[k];
+                                        if (query_region.Inside(item.Position()))
+                                                results.emplace_back(const_cast<type_p*>(&item));
+                                }
+                                return;
+                        }
+
+                        // Split the range into its four quadrants
+                        const unsigned int shift = 2 * (max_depth - 1 - depth);
+                        for (unsigned int k = 0; k < 4; ++k)
+                        {
+                                size_t split = last;
+                                if (k < 3)
+                                {
+                                        unsigned int next = prefix | ((k + 1) << shift);
+                                        split = std::lower_bound(keys.begin() + first, keys.begin() + last, next) - keys.begin();
+                                }
+
+                                AABB child = node_region.Quadrant(k);
+                                if (child.Intersect(query_region))
+                                        query(results, query_region, child, prefix | (k << shift), depth + 1, first, split);
+                                first = split;
+                        }
+                }
+
+        public:
+
+                explicit LinearQuadTree(const AABB& region, const size_t capacity_hint = 10U) :
+                        node_capacity(capacity_hint), region(region)
+                {}
+
+                explicit LinearQuadTree(const AABB& region, allocator_type& allocator, const size_t capacity_hint = 10U) :
+                        node_capacity(capacity_hint), region(region), keys(KeyAlloc(allocator)), content(VecAlloc(allocator))
+                {}
+
+                /*
+                Description: replaces the contents of the tree with a range of elements, sorting them once
+                Remark: the region shrinks to the bounding box of the elements, an empty range keeps the current region
+                */
+                template <typename iterator>
+                void Build(iterator first, iterator last)
+                {
+                        content.assign(first, last);
+                        keys.resize(content.size());
+                        if (!content.empty())
+                        {
+                                vec2 sw = content.front().Position();
+                                vec2 ne = sw;
+                                for (const type_p& item : content)
+                                {
+                                        const vec2& point = item.Position();
+                                        sw.x = std::min(sw.x, point.x); sw.y = std::min(sw.y, point.y);
+                                        ne.x = std::max(ne.x, point.x); ne.y = std::max(ne.y, point.y);
+                                }
+                                if (ne.x == sw.x) ne.x += 1.0f;
+                                if (ne.y == sw.y) ne.y += 1.0f;
+                                region = AABB(sw, ne);
+                        }
+                        sort();
+                }
+
+                type_p* Insert(const type_p& item)
+                {
+                        // If inserting outside of the region expansion is required
+                        while (!region.Inside(item.Position()))
+                                expand(item.Position());
+
+                        unsigned int item_key = key(item.Position());
+                        size_t index = std::upper_bound(keys.begin(), keys.end(), item_key) - keys.begin();
+                        keys.insert(keys.begin() + index, item_key);
+                        content.insert(content.begin() + index, item);
+                        return &content[index];
+                }
+
+                template <typename alloc = std::allocator<type_p*>>
+                std::vector<type_p*, alloc> Query(const AABB& region) const
+                {
+                        std::vector<type_p*, alloc> results;
+
+                        if (this->region.Intersect(region))
+                                query(results, region, this->region, 0, 0, 0, content.size());
+
+                        return results;
+                }
+
+                void Remove(type_p* element)
+                {
+                        size_t index = element - content.data();
+                        keys.erase(keys.begin() + index);
+                        content.erase(content.begin() + index);
+                }
+
+                type_p* Move(type_p* element, const vec2& to)
+                {
+                        if (!region.Inside(to))
+                        {
+                                type_p item = *element;
+                                item.Position(to);
+                                Remove(element);
+                                return Insert(item);
+                        }
+
+                        size_t index = element - content.data();
+                        unsigned int to_key = key(to);
+                        element->Position(to);
+
+                        // Same key, the ordering is unaffected
+                        if (to_key == keys[index]) return element;
+
+                        // Otherwise rotate the element into its new slot, shifting only the elements in between
+                        size_t destination;
+                        if (to_key > keys[index])
+                        {
+                                destination = std::upper_bound(keys.begin() + index + 1, keys.end(), to_key) - keys.begin() - 1;
+                                std::rotate(keys.begin() + index, keys.begin() + index + 1, keys.begin() + destination + 1);
+                                std::rotate(content.begin() + index, content.begin() + index + 1, content.begin() + destination + 1);
+                        }
+                        else
+                        {
+                                destination = std::upper_bound(keys.begin(), keys.begin() + index, to_key) - keys.begin();
+                                std::rotate(keys.begin() + destination, keys.begin() + index, keys.begin() + index + 1);
+                                std::rotate(content.begin() + destination, content.begin() + index, content.begin() + index + 1);
+                        }
+                        keys[destination] = to_key;
+                        return &content[destination];
+                }
+
+                const AABB& Region() const
+                {
+                        return region;
+                }
+
+                size_t Size() const
+                {
+                        return content.size();
+                }
+
+        };
+
+};
+
+#endif // _LINEAR_QUADTREE_H
@@ -3,8 +3,23 @@
 
 #include "config.h"
 #include "AABB.h"
+#include "QuadTreeImage.h"
+#include "QuadTreeSnapshot.h"
+#include "Shapes.h"
+#include "Simd.h"
+#include "ThreadPool.h"
 
-#include <allocators>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 // TODO: Make better methods
@@ -18,15 +33,115 @@
 namespace ORC_NAMESPACE
 {
 
-        template <typename type_p, typename allocator_type = std::allocator<type_p>>
+        /*
+        Subtree summaries kept by every node of a QuadTree, selected through QuadTreeTraits::aggregate_policy and read by QuadTree::Aggregate.
+        A policy provides value_type, Identity(), Of(element) and Combine(a, b), Combine must be associative and commutative with Identity() as its neutral element.
+        REMARK: Summaries are recombined from the children rather than patched with differences, so policies don't need an inverse and sums don't drift
+        */
+        struct NoAggregate
+        {
+                struct value_type {};
+                static const bool enabled = false; // user defined policies set this to true
+                static value_type Identity() { return value_type(); }
+                template <typename type_p> static value_type Of(const type_p&) { return value_type(); }
+                static value_type Combine(const value_type&, const value_type&) { return value_type(); }
+        };
+
+        // Sum of the positions, divided by the Count of the same region it gives their centroid
+        struct PositionSum
+        {
+                typedef vec2 value_type;
+                static const bool enabled = true;
+                static value_type Identity() { return vec2(0.0f, 0.0f); }
+                template <typename type_p> static value_type Of(const type_p& item) { return item.Position(); }
+                static value_type Combine(const value_type& a, const value_type& b) { return a + b; }
+        };
+
+        /*
+        Compile time options of QuadTree, derive from this struct and hide the members that should change
+        */
+        struct QuadTreeTraits
+        {
+                // Leaves keep a copy of the positions in separate x and y arrays so scans can test several points per instruction
+                static const bool soa_leaves = false;
+                // Region queries update the counters reported by QueryCounters, when false the counting is compiled out
+                static const bool count_queries = false;
+                // Summary cached by every node for Aggregate, NoAggregate keeps nothing
+                typedef NoAggregate aggregate_policy;
+        };
+
+        /*
+        Shape of a QuadTree, see QuadTree::Stats
+        */
+        struct QuadTreeStats
+        {
+                size_t nodes;
+                size_t leaves;
+                size_t elements;
+                size_t depth; // of the deepest leaf
+                std::vector<size_t> depth_histogram; // leaves per depth
+                size_t occupancy_histogram[11]; // leaves by size relative to the node capacity, in steps of 10%, the last one is 100% and above
+                size_t overflow_leaves; // leaves grown past the node capacity because they couldn't be split
+                size_t bytes; // nodes, leaf buffers and handle slots
+        };
+
+        /*
+        Work done by the region queries of a QuadTree whose traits enable count_queries, see QuadTree::QueryCounters
+        */
+        struct QueryStats
+        {
+                size_t nodes_visited;
+                size_t leaves_scanned; // leaves whose points had to be tested one by one
+                size_t points_tested;
+                size_t points_emitted;
+        };
+
+        /*
+        Predicate of QuadTree::Join accepting the elements at most distance apart, node pairs farther apart than that can't hold any and are pruned
+        REMARK: Join predicates are called on pairs of node regions and on pairs of elements, the former may only reject regions where no pair of elements could be accepted
+        */
+        struct WithinDistance
+        {
+                float distance_squared;
+
+                explicit WithinDistance(float distance) : distance_squared(distance * distance) {}
+
+                bool operator()(const AABB& a, const AABB& b) const
+                {
+                        return a.DistanceSquared(b) <= distance_squared;
+                }
+
+                template <typename type_a, typename type_b>
+                bool operator()(const type_a& a, const type_b& b) const
+                {
+                        vec2 d = a.Position() - b.Position();
+                        return d.x * d.x + d.y * d.y <= distance_squared;
+                }
+        };
+
+        /*
+        Stable reference to an element of a QuadTree, unlike pointers it survives reallocations, splits and moves
+        Remark: handles are generational, once the element is removed the handle resolves to nothing even if its slot is reused
+        */
+        struct QuadTreeHandle
+        {
+                unsigned int index;
+                unsigned int generation;
+        };
+
+        template <typename type_p, typename allocator_type = std::allocator<type_p>, typename traits_type = QuadTreeTraits>
         class QuadTree
         {
+                template <typename, typename, typename> friend class QuadTree; // Join walks the nodes of the other tree
 
         protected:
 
                 static const unsigned char max_depth = 16;
                 const size_t node_capacity;
 
+                using aggregate_policy = typename traits_type::aggregate_policy;
+                using aggregate_t = typename aggregate_policy::value_type;
+
                 enum GeoRegion
                 {
                         NORTHEAST = 3, SOUTHEAST = 2, SOUTHWEST = 0, NORTHWEST = 1
@@ -35,20 +150,77 @@ namespace ORC_NAMESPACE
                 struct QuadTreeNode
                 {
                         unsigned char depth;
+                        bool changed; // something in the subtree changed since the last Publish, the flag is always set on the ancestors of a changed node too
+                        aggregate_t aggregate; // summary of the whole subtree, next to depth so the empty one of NoAggregate fits in its padding
                         QuadTreeNode* parent;
                         QuadTreeNode* children;
                         AABB region;
                         size_t size;
                         size_t capacity;
+                        size_t count; // elements in the whole subtree
                         type_p* content;
+                        float* positions; // capacity x coordinates followed by capacity y coordinates, only used with soa_leaves
+                        unsigned int* slot_ids; // slot of each element, lets the slot follow it around
+                };
+
+                // Slot map entry, resolves a handle to the element's current location
+                struct Slot
+                {
+                        QuadTreeNode* node; // leaf holding the element, nullptr while the slot is free
+                        size_t offset; // index of the element in the leaf, or the next free slot
+                        unsigned int generation;
                 };
 
                 using alloc_t = std::allocator_traits < allocator_type > ;
                 using NodeAlloc = typename alloc_t::template rebind_alloc < QuadTreeNode > ;
                 using VecAlloc = typename alloc_t::template rebind_alloc < type_p > ;
+                using FloatAlloc = typename alloc_t::template rebind_alloc < float > ;
+                using IndexAlloc = typename alloc_t::template rebind_alloc < unsigned int > ;
 
                 NodeAlloc node_alloc;
                 VecAlloc vec_alloc;
+                FloatAlloc float_alloc;
+                IndexAlloc index_alloc;
+
+                static const size_t no_slot = static_cast<size_t>(-1);
+                std::vector<Slot> slots;
+                size_t free_slot;
+
+                // Element waiting to be reinserted by MoveAll
+                struct Pending
+                {
+                        unsigned int key;
+                        unsigned int slot;
+                        type_p item;
+                };
+
+                // Scratch buffers of MoveAll, kept between calls so batches don't allocate once they're warm
+                std::vector<unsigned int> crossing;
+                std::vector<Pending> pending;
+
+                using snapshot_t = QuadTreeSnapshot < type_p > ;
+                using shared_snapshot_t = QuadTreeSharedSnapshot < type_p > ;
+
+                // Published snapshot and the number of readers holding it, a version is only rewritten by Publish once no reader holds it
+                struct Version
+                {
+                        std::atomic<size_t> readers;
+                        shared_snapshot_t snapshot;
+
+                        Version() : readers(0)
+                        {}
+                };
+
+                // Versions are never freed before the tree, so a reader can always reach the counter of the version it loaded, only published is read by other threads
+                std::vector<std::unique_ptr<Version>> versions;
+                std::atomic<Version*> published;
+
+                // Pieces of the last publish by the subtree they were copied from, a subtree that didn't change since reuses its piece
+                std::unordered_map<const QuadTreeNode*, std::shared_ptr<const snapshot_t>> pieces;
+                std::unordered_map<const QuadTreeNode*, std::shared_ptr<const snapshot_t>> fresh_pieces;
+
+                // Only updated when traits_type::count_queries is set, queries may run concurrently so every traversal adds its totals once
+                mutable std::atomic<size_t> query_counters[4];
 
                 QuadTreeNode root;
 
@@ -84,35 +256,220 @@ namespace ORC_NAMESPACE
                         }
                 }
 
-                type_p* insert(QuadTreeNode* node, const type_p* point)
+                unsigned int acquire_slot()
+                {
+                        if (free_slot == no_slot)
+                        {
+                                Slot slot = {nullptr, 0, 0};
+                                slots.push_back(slot);
+                                return static_cast<unsigned int>(slots.size() - 1);
+                        }
+                        unsigned int index = static_cast<unsigned int>(free_slot);
+                        free_slot = slots[index].offset;
+                        return index;
+                }
+
+                void release_slot(unsigned int index)
+                {
+                        slots[index].node = nullptr;
+                        slots[index].offset = free_slot;
+                        slots[index].generation++;
+                        free_slot = index;
+                }
+
+                void release_slots()
+                {
+                        for (size_t k = 0; k < slots.size(); ++k)
+                        {
+                                if (slots[k].node != nullptr) release_slot(static_cast<unsigned int>(k));
+                        }
+                }
+
+                const Slot* resolve(QuadTreeHandle handle) const
+                {
+                        if (handle.index >= slots.size()) return nullptr;
+                        const Slot* slot = &slots[handle.index];
+                        return (slot->node != nullptr && slot->generation == handle.generation) ? slot : nullptr;
+                }
+
+                QuadTreeHandle handle(unsigned int slot) const
+                {
+                        QuadTreeHandle result = {slot, slots[slot].generation};
+                        return result;
+                }
+
+                type_p* element(unsigned int slot) const
+                {
+                        return &slots[slot].node->content[slots[slot].offset];
+                }
+
+                void allocate_leaf(QuadTreeNode* node, size_t capacity)
+                {
+                        node->capacity = capacity;
+                        node->content = vec_alloc.allocate(capacity, node);
+                        node->positions = traits_type::soa_leaves ? float_alloc.allocate(2 * capacity, node) : nullptr;
+                        node->slot_ids = index_alloc.allocate(capacity, node);
+                }
+
+                void deallocate_leaf(QuadTreeNode* node)
+                {
+                        vec_alloc.deallocate(node->content, node->capacity);
+                        if (traits_type::soa_leaves) float_alloc.deallocate(node->positions, 2 * node->capacity);
+                        index_alloc.deallocate(node->slot_ids, node->capacity);
+                        node->capacity = 0;
+                        node->content = nullptr;
+                        node->positions = nullptr;
+                        node->slot_ids = nullptr;
+                }
+
+                // Refreshes the coordinate arrays after the position of an element changed
+                static void reposition(QuadTreeNode* node, size_t index)
+                {
+                        if (!traits_type::soa_leaves) return;
+                        const vec2& point = node->content[index].Position();
+                        node->positions[index] = point.x;
+                        node->positions[node->capacity + index] = point.y;
+                }
+
+                // Flags the node and its ancestors for the next Publish, an ancestor already flagged has flagged its own ancestors
+                static void touch(QuadTreeNode* node)
+                {
+                        for (; node != nullptr && !node->changed; node = node->parent) node->changed = true;
+                }
+
+                void store(QuadTreeNode* node, size_t index, const type_p& item, unsigned int slot)
+                {
+                        touch(node);
+                        node->content[index] = item;
+                        node->slot_ids[index] = slot;
+                        slots[slot].node = node;
+                        slots[slot].offset = index;
+                        reposition(node, index);
+                }
+
+                void relocate(QuadTreeNode* node, size_t to, size_t from)
+                {
+                        node->content[to] = node->content[from];
+                        node->slot_ids[to] = node->slot_ids[from];
+                        slots[node->slot_ids[to]].offset = to;
+                        if (traits_type::soa_leaves)
+                        {
+                                node->positions[to] = node->positions[from];
+                                node->positions[node->capacity + to] = node->positions[node->capacity + from];
+                        }
+                }
+
+                // Simply allocate more memory for the leaf
+                void grow(QuadTreeNode* node)
+                {
+                        QuadTreeNode old = *node;
+                        allocate_leaf(node, old.capacity + node_capacity);
+                        std::memcpy(node->content, old.content, sizeof(type_p) * old.size);
+                        std::memcpy(node->slot_ids, old.slot_ids, sizeof(unsigned int) * old.size);
+                        if (traits_type::soa_leaves)
+                        {
+                                std::memcpy(node->positions, old.positions, sizeof(float) * old.size);
+                                std::memcpy(node->positions + node->capacity, old.positions + old.capacity, sizeof(float) * old.size);
+                        }
+                        deallocate_leaf(&old);
+                }
+
+                // Returns the element's final location, which may be in a child if the leaf had to be partitioned
+                type_p* insert(QuadTreeNode* node, const type_p* point, unsigned int slot)
                 {
-                        node->content[node->size] = *point;
-                        type_p* element = &node->content[node->size];
+                        store(node, node->size, *point, slot);
                         node->size = node->size + 1;
+                        node->count = node->count + 1;
                         if (node->size >= node->capacity) // partitioning or reallocation may be required
                         {
                                 if ((node->depth < max_depth) && should_expand(node)) buy(node);
-                                else // Simply allocate more memory for the region
+                                else grow(node);
+                        }
+                        return element(slot);
+                }
+
+                // Swaps the last element into the hole, the slot of the removed element is left for the caller to release or reuse
+                void remove(QuadTreeNode* node, size_t index)
+                {
+                        touch(node);
+                        if (index != node->size - 1) relocate(node, index, node->size - 1);
+                        --node->size;
+                        --node->count;
+                }
+
+                // Moves every element of the subtrees into node, which must already be a leaf with enough room
+                void gather(QuadTreeNode* node, QuadTreeNode* children)
+                {
+                        for (size_t k = 0; k < 4; ++k)
+                        {
+                                QuadTreeNode* child = &children[k];
+                                if (child->children != nullptr) // internal node
+                                {
+                                        gather(node, child->children);
+                                }
+                                else // leaf node
                                 {
-                                        node->capacity += node_capacity;
-                                        type_p* new_content = vec_alloc.allocate(node->capacity, node);
-                                        std::memcpy(new_content, node->content, sizeof(type_p) * node->size);
-                                        vec_alloc.deallocate(node->content, node->size);
-                                        node->content = new_content;
+                                        for (size_t c = 0; c < child->size; ++c)
+                                                store(node, node->size++, child->content[c], child->slot_ids[c]);
+                                        deallocate_leaf(child);
                                 }
                         }
-                        return element;
+                        node_alloc.deallocate(children, 4);
                 }
 
-                void remove(QuadTreeNode* node, type_p* point)
+                // Hysteresis: leaves split once they fill up, but subtrees only merge back once they're half empty
+                void shrink(QuadTreeNode* leaf)
                 {
-                        bool found = false;
-                        for (size_t k = 0; k < node->size; ++k)
+                        QuadTreeNode* target = nullptr;
+                        for (QuadTreeNode* node = leaf->parent; node != nullptr && node->count <= node_capacity / 2; node = node->parent)
+                                target = node;
+                        if (target == nullptr) return;
+
+                        QuadTreeNode* children = target->children;
+                        target->children = nullptr;
+                        target->size = 0;
+                        allocate_leaf(target, node_capacity);
+                        gather(target, children);
+                        summarize(target, target->parent);
+                }
+
+                // Applies a change in element count to the ancestors of node, up to but excluding stop
+                static void propagate(QuadTreeNode* node, const QuadTreeNode* stop, long delta)
+                {
+                        for (; node != stop; node = node->parent) node->count += delta;
+                }
+
+                // Summary of a node computed from its children, or from its elements if it's a leaf
+                static aggregate_t summary(const QuadTreeNode* node)
+                {
+                        aggregate_t result = aggregate_policy::Identity();
+                        if (node->children != nullptr)
                         {
-                                node->content[k - found] = node->content[k];
-                                if (&node->content[k] == point) found = true;
+                                for (size_t k = 0; k < 4; ++k) result = aggregate_policy::Combine(result, node->children[k].aggregate);
                         }
-                        if (found) --node->size;
+                        else
+                        {
+                                for (size_t k = 0; k < node->size; ++k) result = aggregate_policy::Combine(result, aggregate_policy::Of(node->content[k]));
+                        }
+                        return result;
+                }
+
+                // Recomputes the summaries of node and its ancestors, up to but excluding stop
+                static void summarize(QuadTreeNode* node, const QuadTreeNode* stop)
+                {
+                        if (!aggregate_policy::enabled) return;
+                        for (; node != stop; node = node->parent) node->aggregate = summary(node);
+                }
+
+                // Recomputes the summaries of a whole subtree bottom up, subtrees holding fewer than threshold elements are known to be up to date
+                static void summarize_subtree(QuadTreeNode* node, size_t threshold)
+                {
+                        if (!aggregate_policy::enabled || node->count < threshold) return;
+                        if (node->children != nullptr)
+                        {
+                                for (size_t k = 0; k < 4; ++k) summarize_subtree(&node->children[k], threshold);
+                        }
+                        node->aggregate = summary(node);
                 }
 
                 void buy(QuadTreeNode* parent)
@@ -124,28 +481,85 @@ namespace ORC_NAMESPACE
                                 parent->children[k].parent = parent;
                                 parent->children[k].children = nullptr;
                                 parent->children[k].size = 0;
-                                parent->children[k].content = vec_alloc.allocate(node_capacity, &parent->children[k]);
+                                parent->children[k].count = 0;
                                 parent->children[k].depth = parent->depth + 1;
-                                parent->children[k].capacity = node_capacity;
+                                parent->children[k].changed = true;
+                                allocate_leaf(&parent->children[k], node_capacity);
+                                parent->children[k].region = parent->region.Quadrant(k);
                         }
 
+                        touch(parent);
                         vec2 center = parent->region.Center();
-                        parent->children[SOUTHWEST].region = AABB(parent->region.BottomLeft(), center);
-                        parent->children[SOUTHEAST].region = AABB(parent->region.BottomRight(), center);
-                        parent->children[NORTHWEST].region = AABB(parent->region.TopLeft(), center);
-                        parent->children[NORTHEAST].region = AABB(parent->region.TopRight(), center);
 
-                        // Copying existing points to the correct child
-                        for (type_p* point = parent->content; point != (parent->content + parent->size); ++point)
+                        // Copying existing points to the correct child, which may itself have been partitioned by a previous point
+                        for (size_t k = 0; k < parent->size; ++k)
                         {
-                                unsigned int child_index = partition(center, point->Position());
-                                insert(&parent->children[child_index], point);
+                                const vec2& point = parent->content[k].Position();
+                                QuadTreeNode* child = &parent->children[partition(center, point)];
+                                descend(child, point);
+                                insert(child, &parent->content[k], parent->slot_ids[k]);
+                                propagate(child->parent, parent, 1);
                         }
 
-                        // Finally, clean up the parent node
-                        vec_alloc.deallocate(parent->content, node_capacity);
+                        // Finally, clean up the parent node, the children were filled without their summaries
+                        deallocate_leaf(parent);
                         parent->size = 0;
-                        parent->content = nullptr;
+                        summarize_subtree(parent, 0);
+                }
+
+                // Updates the position of an element that stays in its leaf
+                static void update(QuadTreeNode* leaf, size_t index, const vec2& to)
+                {
+                        touch(leaf);
+                        leaf->content[index].Position(to);
+                        reposition(leaf, index);
+                        summarize(leaf, nullptr);
+                }
+
+                // Grows the region until it contains the point, returns true if it had to grow
+                bool enclose(const vec2& point)
+                {
+                        bool grown = false;
+                        for (; !root.region.Inside(point); grown = true) expand(point);
+                        return grown;
+                }
+
+                type_p* move(QuadTreeNode* source, size_t index, const vec2& to)
+                {
+                        // Grow the region first, the root's content moves down when it does so the element is found again through its slot
+                        unsigned int slot = source->slot_ids[index];
+                        if (enclose(to))
+                        {
+                                source = slots[slot].node;
+                                index = slots[slot].offset;
+                        }
+
+                        // Move back up until it's in range, then down to the leaf containing the destination point
+                        QuadTreeNode* destination = source;
+                        ascend(destination, to);
+                        QuadTreeNode* common = destination;
+                        descend(destination, to);
+
+                        // If it's inside the same leaf, just update its position
+                        if (destination == source)
+                        {
+                                update(source, index, to);
+                                return &source->content[index];
+                        }
+
+                        // Update its position, insert in destination and remove from source, the slot follows the element
+                        type_p* element = &source->content[index];
+                        element->Position(to);
+                        insert(destination, element, slot);
+                        remove(source, index);
+
+                        // Counts only change below the common ancestor
+                        propagate(destination->parent, common, 1);
+                        propagate(source->parent, common, -1);
+                        summarize(destination, common);
+                        summarize(source, nullptr);
+                        shrink(source);
+                        return this->element(slot);
                 }
 
                 static void ascend(QuadTreeNode*& node, vec2 point)
@@ -166,6 +580,35 @@ namespace ORC_NAMESPACE
                         }
                 }
 
+                // True if node is a leaf storing the element
+                static bool holds(const QuadTreeNode* node, const type_p* element)
+                {
+                        return node->children == nullptr && element >= node->content && element < node->content + node->size;
+                }
+
+                // Searches the leaves whose region contains the point for the one holding the element
+                static QuadTreeNode* find_leaf(QuadTreeNode* node, const vec2& point, const type_p* element)
+                {
+                        if (node->children == nullptr) return holds(node, element) ? node : nullptr;
+                        for (size_t k = 0; k < 4; ++k)
+                        {
+                                QuadTreeNode* child = &node->children[k];
+                                if (!child->region.Inside(point)) continue;
+                                QuadTreeNode* leaf = find_leaf(child, point, element);
+                                if (leaf != nullptr) return leaf;
+                        }
+                        return nullptr;
+                }
+
+                // Leaf holding the element, nullptr if it isn't in the tree
+                QuadTreeNode* locate(const type_p* element)
+                {
+                        // Elements kept in place by Move and MoveAll may sit on the boundary of a leaf descend wouldn't pick
+                        QuadTreeNode* leaf = &root;
+                        descend(leaf, element->Position());
+                        return holds(leaf, element) ? leaf : find_leaf(&root, element->Position(), element);
+                }
+
                 void expand(vec2 point) // This is extremely slow, it's best to avoid adding elements outside of the region altogether
                 {
                         vec2 ne, sw;
@@ -204,13 +647,19 @@ namespace ORC_NAMESPACE
                                 {
                                         intermediates[k] = root;
                                         inc_depth(&intermediates[k]);
+                                        if (root.children != nullptr)
+                                        {
+                                                for (size_t c = 0; c < 4; ++c) root.children[c].parent = &intermediates[k];
+                                        }
+                                        for (size_t c = 0; c < root.size; ++c) slots[root.slot_ids[c]].node = &intermediates[k];
                                 }
                                 else
                                 {
                                         intermediates[k].size = 0;
-                                        intermediates[k].capacity = node_capacity;
-                                        intermediates[k].content = vec_alloc.allocate(node_capacity, &intermediates[k]);
+                                        intermediates[k].count = 0;
+                                        intermediates[k].aggregate = aggregate_policy::Identity();
                                         intermediates[k].children = nullptr;
+                                        allocate_leaf(&intermediates[k], node_capacity);
 
                                         vec2 pos;
                                         switch (k)
@@ -225,141 +674,1465 @@ namespace ORC_NAMESPACE
 
                                 intermediates[k].parent = &root;
                                 intermediates[k].depth = root.depth + 1;
+                                intermediates[k].changed = true;
                         }
 
-                        if (root.size > 0) vec_alloc.deallocate(root.content, root.size);
+                        // The content, if any, now belongs to the target node
                         root.size = 0;
                         root.capacity = 0;
+                        root.content = nullptr;
+                        root.positions = nullptr;
+                        root.slot_ids = nullptr;
                         root.region = region;
                         root.children = intermediates;
+                        root.changed = true;
                 }
 
-                template <typename alloc = std::allocator<type_p*>>
-                void query(std::vector<type_p*>& results, const AABB& region, const QuadTreeNode* node) const
+                // Enough room for a depth first walk of a tree max_depth levels deep, each level leaves at most 3 siblings behind
+                static const size_t stack_size = 3 * max_depth + 1;
+
+                struct NoReserve
                 {
-                        if (node->children != nullptr) // internal node, descend
+                        void operator()(size_t) const {}
+                };
+
+                // Emits every element of the subtree, used when the node is entirely inside the query region
+                template <typename callback_type>
+                void emit(const QuadTreeNode* node, callback_type& callback) const
+                {
+                        const QuadTreeNode* stack[stack_size];
+                        size_t top = 0;
+                        stack[top++] = node;
+
+                        while (top > 0)
                         {
-                                for (size_t k = 0; k < 4; ++k)
+                                node = stack[--top];
+                                if (node->children != nullptr) // internal node, descend
                                 {
-                                        QuadTreeNode* child = &node->children[k];
-                                        if (child->region.Intersect(region))
-                                                query(results, region, child);
+                                        for (size_t k = 0; k < 4; ++k)
+                                        {
+                                                const QuadTreeNode* child = &node->children[k];
+                                                if (child->count == 0) continue;
+                                                if (top < stack_size) stack[top++] = child;
+                                                else emit(child, callback);
+                                        }
                                 }
-                        }
-                        else // leaf node
-                        {
-                                for (size_t k = 0; k < node->size; ++k)
+                                else // leaf node
                                 {
-                                        type_p& item = node->content[k];
-                                        if (region.Inside(item.Position()))
-                                                results.emplace_back(&item);
+                                        for (size_t k = 0; k < node->size; ++k) callback(node->content[k]);
                                 }
                         }
                 }
 
-                void free(QuadTreeNode* node)
+                // Iterative traversal, the stack lives on the call stack so no allocations are performed
+                template <typename callback_type, typename reserve_type>
+                void for_each(const AABB& region, const QuadTreeNode* node, callback_type& callback, reserve_type& reserve) const
                 {
-                        if (node->children != nullptr) // internal node
+                        const QuadTreeNode* stack[stack_size];
+                        size_t top = 0;
+                        stack[top++] = node;
+                        size_t visited = 0, scanned = 0, tested = 0, emitted = 0;
+
+                        while (top > 0)
                         {
-                                for (size_t k = 0; k < 4; ++k) free(&node->children[k]);
-                                node_alloc.deallocate(node->children, 4);
+                                node = stack[--top];
+                                if (traits_type::count_queries) ++visited;
+
+                                if (region.Contains(node->region)) // whole node accepted, no need to test its points
+                                {
+                                        if (traits_type::count_queries) emitted += node->count;
+                                        reserve(node->count);
+                                        emit(node, callback);
+                                }
+                                else if (node->children != nullptr) // internal node, descend
+                                {
+                                        for (size_t k = 0; k < 4; ++k)
+                                        {
+                                                const QuadTreeNode* child = &node->children[k];
+                                                if (child->count == 0 || !child->region.Intersect(region)) continue;
+                                                if (top < stack_size) stack[top++] = child;
+                                                else for_each(region, child, callback, reserve); // only reachable once expand() pushed leaves past max_depth
+                                        }
+                                }
+                                else if (traits_type::soa_leaves) // leaf node, the positions are tested several at a time
+                                {
+                                        type_p* content = node->content;
+                                        auto accept = [&callback, &emitted, content](size_t k)
+                                        {
+                                                if (traits_type::count_queries) ++emitted;
+                                                callback(content[k]);
+                                        };
+                                        if (traits_type::count_queries) ++scanned, tested += node->size;
+                                        util::ScanInside(node->positions, node->positions + node->capacity, node->size, region, accept);
+                                }
+                                else // leaf node
+                                {
+                                        if (traits_type::count_queries) ++scanned, tested += node->size;
+                                        for (size_t k = 0; k < node->size; ++k)
+                                        {
+                                                type_p& item = node->content[k];
+                                                if (region.Inside(item.Position()))
+                                                {
+                                                        if (traits_type::count_queries) ++emitted;
+                                                        callback(item);
+                                                }
+                                        }
+                                }
                         }
-                        else // leaf node
+
+                        if (traits_type::count_queries)
                         {
-                                vec_alloc.deallocate(node->content, node_capacity);
+                                query_counters[0].fetch_add(visited, std::memory_order_relaxed);
+                                query_counters[1].fetch_add(scanned, std::memory_order_relaxed);
+                                query_counters[2].fetch_add(tested, std::memory_order_relaxed);
+                                query_counters[3].fetch_add(emitted, std::memory_order_relaxed);
                         }
                 }
 
-                void init_root(const AABB& region)
+                // Same walk as for_each, nodes are classified against the shape instead of tested against a box
+                template <typename shape_type, typename callback_type>
+                void shape_for_each(const shape_type& shape, const QuadTreeNode* node, callback_type& callback) const
                 {
-                        root.region = region;
-                        root.size = 0;
-                        root.children = nullptr;
-                        root.parent = nullptr;
-                        root.content = vec_alloc.allocate(node_capacity, &root);
-                        root.depth = 0;
-                        root.capacity = node_capacity;
-                }
-
-        public:
+                        const QuadTreeNode* stack[stack_size];
+                        size_t top = 0;
+                        stack[top++] = node;
 
-                explicit QuadTree(const AABB& region, const size_t capacity_hint = 10U) :
-                        node_capacity(capacity_hint)
-                {
-                        init_root(region);
+                        while (top > 0)
+                        {
+                                node = stack[--top];
+                                Overlap overlap = shape.Classify(node->region);
+                                if (overlap == OUTSIDE) continue;
 
+                                if (overlap == INSIDE) // whole node accepted, no need to test its points
+                                {
+                                        emit(node, callback);
+                                }
+                                else if (node->children != nullptr) // internal node, descend
+                                {
+                                        for (size_t k = 0; k < 4; ++k)
+                                        {
+                                                const QuadTreeNode* child = &node->children[k];
+                                                if (child->count == 0) continue;
+                                                if (top < stack_size) stack[top++] = child;
+                                                else shape_for_each(shape, child, callback);
+                                        }
+                                }
+                                else // leaf node, only partially covered leaves test their points
+                                {
+                                        for (size_t k = 0; k < node->size; ++k)
+                                        {
+                                                type_p& item = node->content[k];
+                                                if (shape.Inside(item.Position()))
+                                                        callback(item);
+                                        }
+                                }
+                        }
                 }
 
-                explicit QuadTree(const AABB& region, allocator_type& allocator, const size_t capacity_hint = 10U) :
-                        node_capacity(capacity_hint), node_alloc(allocator), vec_alloc(allocator)
+                // Same walk as for_each, nodes inside the region are handed to whole instead of being emitted, the points of the leaves on its border to partial
+                template <typename whole_type, typename partial_type>
+                void cover(const AABB& region, const QuadTreeNode* node, whole_type& whole, partial_type& partial) const
                 {
-                        init_root(region);
+                        const QuadTreeNode* stack[stack_size];
+                        size_t top = 0;
+                        stack[top++] = node;
+
+                        while (top > 0)
+                        {
+                                node = stack[--top];
+                                if (region.Contains(node->region)) // whole node accepted, its cached count and summary stand for its elements
+                                {
+                                        whole(node);
+                                }
+                                else if (node->children != nullptr) // internal node, descend
+                                {
+                                        for (size_t k = 0; k < 4; ++k)
+                                        {
+                                                const QuadTreeNode* child = &node->children[k];
+                                                if (child->count == 0 || !child->region.Intersect(region)) continue;
+                                                if (top < stack_size) stack[top++] = child;
+                                                else cover(region, child, whole, partial);
+                                        }
+                                }
+                                else if (traits_type::soa_leaves) // leaf node, the positions are tested several at a time
+                                {
+                                        type_p* content = node->content;
+                                        auto accept = [&partial, content](size_t k) { partial(content[k]); };
+                                        util::ScanInside(node->positions, node->positions + node->capacity, node->size, region, accept);
+                                }
+                                else // leaf node
+                                {
+                                        for (size_t k = 0; k < node->size; ++k)
+                                        {
+                                                if (region.Inside(node->content[k].Position())) partial(node->content[k]);
+                                        }
+                                }
+                        }
                 }
 
-                virtual ~QuadTree()
+                void stats(const QuadTreeNode* node, QuadTreeStats& result) const
                 {
-                        free(&root);
+                        ++result.nodes;
+                        if (node->children != nullptr) // internal node
+                        {
+                                result.bytes += 4 * sizeof(QuadTreeNode);
+                                for (size_t k = 0; k < 4; ++k) stats(&node->children[k], result);
+                                return;
+                        }
+
+                        // leaf node
+                        ++result.leaves;
+                        result.elements += node->size;
+                        result.bytes += node->capacity * (sizeof(type_p) + sizeof(unsigned int) + (traits_type::soa_leaves ? 2 * sizeof(float) : 0));
+                        if (node->depth >= result.depth_histogram.size()) result.depth_histogram.resize(node->depth + 1, 0);
+                        ++result.depth_histogram[node->depth];
+                        if (node->depth > result.depth) result.depth = node->depth;
+                        ++result.occupancy_histogram[std::min<size_t>(node->size * 10 / node_capacity, 10)];
+                        if (node->capacity > node_capacity) ++result.overflow_leaves;
                 }
 
-                type_p* Insert(const type_p& item)
+                // Collects the subtrees a parallel query is split into, nodes are split until they hold at most grain elements
+                void fan_out(const AABB& region, const QuadTreeNode* node, size_t grain, std::vector<const QuadTreeNode*>& tasks) const
                 {
-                        // If inserting outside of the region expansion is required
-                        while (!root.region.Inside(item.Position()))
-                                expand(item.Position());
-
-                        // Descend to the appropriate leaf
-                        QuadTreeNode* current = &root;
-                        descend(current, item.Position());
+                        if (node->children == nullptr || node->count <= grain)
+                        {
+                                tasks.push_back(node);
+                                return;
+                        }
 
-                        // Perform the operation
-                        return insert(current, &item);
+                        for (size_t k = 0; k < 4; ++k)
+                        {
+                                const QuadTreeNode* child = &node->children[k];
+                                if (child->count != 0 && child->region.Intersect(region))
+                                        fan_out(region, child, grain, tasks);
+                        }
                 }
 
-                template <typename alloc = std::allocator<type_p*>>
-                std::vector<type_p*, alloc> Query(const AABB& region) const
+                // Splits the query into roughly four tasks per worker, fewer if the tree is small
+                void fan_out(const AABB& region, ThreadPool& pool, std::vector<const QuadTreeNode*>& tasks) const
                 {
-                        std::vector<type_p*> results;
-
+                        const size_t grain = std::max(size_t(parallel_grain), root.count / (4 * pool.Size()) + 1);
                         if (root.region.Intersect(region))
-                                query(results, region, &root);
-
-                        return results;
+                                fan_out(region, &root, grain, tasks);
                 }
 
-                void Remove(type_p* element)
+                // True if the region lies strictly inside the node, so no element stored outside of the node's subtree can match it
+                static bool encloses(const AABB& node, const AABB& region)
                 {
+                        const vec2 sw = node.BottomLeft(), ne = node.TopRight();
+                        const vec2 low = region.BottomLeft(), high = region.TopRight();
+                        return low.x > sw.x && low.y > sw.y && high.x < ne.x && high.y < ne.y;
+                }
+
+                static float distance_squared(const vec2& a, const vec2& b)
+                {
+                        vec2 d = a - b;
+                        return d.x * d.x + d.y * d.y;
+                }
+
+                // Orders priority queue entries by distance only
+                template <typename entry>
+                struct FartherFirst
+                {
+                        bool operator()(const entry& a, const entry& b) const { return a.first > b.first; }
+                };
+                template <typename entry>
+                struct CloserFirst
+                {
+                        bool operator()(const entry& a, const entry& b) const { return a.first < b.first; }
+                };
+
+                // Best-first search: nodes are expanded closest first and pruned once they're farther than the k-th best candidate
+                void nearest(std::vector<type_p*>& results, const vec2& point, size_t k, float max_distance_squared) const
+                {
+                        using node_entry = std::pair < float, const QuadTreeNode* > ;
+                        using item_entry = std::pair < float, type_p* > ;
+
+                        if (k == 0) return;
+
+                        std::priority_queue<node_entry, std::vector<node_entry>, FartherFirst<node_entry>> nodes;
+                        std::priority_queue<item_entry, std::vector<item_entry>, CloserFirst<item_entry>> best; // max heap holding at most k elements
+                        nodes.emplace(root.region.DistanceSquared(point), &root);
+
+                        while (!nodes.empty())
+                        {
+                                const float bound = best.size() == k ? best.top().first : max_distance_squared;
+                                node_entry current = nodes.top();
+                                nodes.pop();
+                                if (current.first > bound) break; // every remaining node is even farther
+
+                                const QuadTreeNode* node = current.second;
+                                if (node->children != nullptr) // internal node, queue the children that may still hold a candidate
+                                {
+                                        for (size_t c = 0; c < 4; ++c)
+                                        {
+                                                const QuadTreeNode* child = &node->children[c];
+                                                float distance = child->region.DistanceSquared(point);
+                                                if (distance <= bound) nodes.emplace(distance, child);
+                                        }
+                                }
+                                else // leaf node
+                                {
+                                        for (size_t c = 0; c < node->size; ++c)
+                                        {
+                                                type_p& item = node->content[c];
+                                                float distance = distance_squared(item.Position(), point);
+                                                if (distance > max_distance_squared) continue;
+                                                if (best.size() < k) best.emplace(distance, &item);
+                                                else if (distance < best.top().first)
+                                                {
+                                                        best.pop();
+                                                        best.emplace(distance, &item);
+                                                }
+                                        }
+                                }
+                        }
+
+                        // The heap pops farthest first
+                        size_t offset = results.size();
+                        results.resize(offset + best.size());
+                        for (size_t c = results.size(); c > offset; --c)
+                        {
+                                results[c - 1] = best.top().second;
+                                best.pop();
+                        }
+                }
+
+                // Clips the interval [enter, exit] of the ray to the slab of one axis, false once it's empty
+                static bool clip(float origin, float direction, float low, float high, float& enter, float& exit)
+                {
+                        if (direction == 0.0f) return origin >= low && origin <= high; // parallel to the slab
+                        float from_low = (low - origin) / direction;
+                        float from_high = (high - origin) / direction;
+                        if (from_low > from_high) std::swap(from_low, from_high);
+                        enter = std::max(enter, from_low);
+                        exit = std::min(exit, from_high);
+                        return enter <= exit;
+                }
+
+                // Part of the ray crossing the box as distances along it, false if the box is missed within [0, max_distance]
+                static bool crossing_interval(const AABB& box, const vec2& origin, const vec2& direction, float max_distance, float& enter, float& exit)
+                {
+                        enter = 0.0f;
+                        exit = max_distance;
+                        const vec2 sw = box.BottomLeft();
+                        const vec2 ne = box.TopRight();
+                        return clip(origin.x, direction.x, sw.x, ne.x, enter, exit) && clip(origin.y, direction.y, sw.y, ne.y, enter, exit);
+                }
+
+                // Elements of a leaf ordered by their distance along the ray, leaves larger than the local buffer use the spill vector
+                typedef std::pair<float, size_t> ray_entry;
+                static const size_t ray_buffer = 64;
+
+                // Front to back walk, returns true once the callback reported a hit
+                template <typename callback_type>
+                bool raycast(const QuadTreeNode* node, const vec2& origin, const vec2& direction, float max_distance, callback_type& callback, std::vector<ray_entry>& spill) const
+                {
+                        if (node->children != nullptr) // internal node, the children the ray crosses are visited in the order it enters them
+                        {
+                                ray_entry order[4];
+                                size_t crossed = 0;
+                                for (size_t k = 0; k < 4; ++k)
+                                {
+                                        const QuadTreeNode* child = &node->children[k];
+                                        float enter, exit;
+                                        if (child->count == 0 || !crossing_interval(child->region, origin, direction, max_distance, enter, exit)) continue;
+
+                                        size_t c = crossed++;
+                                        for (; c > 0 && order[c - 1].first > enter; --c) order[c] = order[c - 1];
+                                        order[c] = ray_entry(enter, k);
+                                }
+                                for (size_t c = 0; c < crossed; ++c)
+                                {
+                                        if (raycast(&node->children[order[c].second], origin, direction, max_distance, callback, spill)) return true;
+                                }
+                                return false;
+                        }
+
+                        // Leaf node, its elements are offered closest first along the ray, those behind the origin or past max_distance are skipped
+                        ray_entry local[ray_buffer];
+                        ray_entry* entries = local;
+                        if (node->size > ray_buffer)
+                        {
+                                spill.resize(node->size);
+                                entries = spill.data();
+                        }
+
+                        size_t count = 0;
+                        for (size_t k = 0; k < node->size; ++k)
+                        {
+                                const vec2 offset = node->content[k].Position() - origin;
+                                const float distance = offset.x * direction.x + offset.y * direction.y;
+                                if (distance >= 0.0f && distance <= max_distance) entries[count++] = ray_entry(distance, k);
+                        }
+                        std::sort(entries, entries + count);
+
+                        for (size_t k = 0; k < count; ++k)
+                        {
+                                if (callback(node->content[entries[k].second], entries[k].first)) return true;
+                        }
+                        return false;
+                }
+
+                // Self-join of a subtree: pairs inside each child, then pairs across every two of its children
+                template <typename callback_type>
+                void pairs(const QuadTreeNode* node, float max_distance_squared, callback_type& callback) const
+                {
+                        if (node->count < 2) return;
+
+                        if (node->children == nullptr) // leaf node, every pair of its elements once
+                        {
+                                for (size_t i = 0; i < node->size; ++i)
+                                {
+                                        type_p& first = node->content[i];
+                                        for (size_t j = i + 1; j < node->size; ++j)
+                                        {
+                                                if (distance_squared(first.Position(), node->content[j].Position()) <= max_distance_squared)
+                                                        callback(first, node->content[j]);
+                                        }
+                                }
+                                return;
+                        }
+
+                        for (size_t k = 0; k < 4; ++k)
+                        {
+                                pairs(&node->children[k], max_distance_squared, callback);
+                                for (size_t c = k + 1; c < 4; ++c) pairs(&node->children[k], &node->children[c], max_distance_squared, callback);
+                        }
+                }
+
+                // Pairs across two disjoint subtrees, node pairs farther apart than the distance are pruned and the larger node is split first
+                template <typename callback_type>
+                void pairs(const QuadTreeNode* a, const QuadTreeNode* b, float max_distance_squared, callback_type& callback) const
+                {
+                        if (a->count == 0 || b->count == 0 || a->region.DistanceSquared(b->region) > max_distance_squared) return;
+
+                        if (a->children == nullptr && b->children == nullptr) // two leaves, every element of one against every element of the other
+                        {
+                                for (size_t i = 0; i < a->size; ++i)
+                                {
+                                        type_p& first = a->content[i];
+                                        for (size_t j = 0; j < b->size; ++j)
+                                        {
+                                                if (distance_squared(first.Position(), b->content[j].Position()) <= max_distance_squared)
+                                                        callback(first, b->content[j]);
+                                        }
+                                }
+                                return;
+                        }
+
+                        if (b->children == nullptr || (a->children != nullptr && a->depth <= b->depth))
+                        {
+                                for (size_t k = 0; k < 4; ++k) pairs(&a->children[k], b, max_distance_squared, callback);
+                        }
+                        else
+                        {
+                                for (size_t k = 0; k < 4; ++k) pairs(a, &b->children[k], max_distance_squared, callback);
+                        }
+                }
+
+                // Dual tree walk, node pairs rejected by the predicate are pruned and the larger node is split first
+                template <typename other_node, typename predicate_type, typename callback_type>
+                void join(const QuadTreeNode* a, const other_node* b, predicate_type& predicate, callback_type& callback) const
+                {
+                        if (a->count == 0 || b->count == 0 || !predicate(a->region, b->region)) return;
+
+                        if (a->children == nullptr && b->children == nullptr) // two leaves, every element of one against every element of the other
+                        {
+                                for (size_t i = 0; i < a->size; ++i)
+                                {
+                                        type_p& first = a->content[i];
+                                        for (size_t j = 0; j < b->size; ++j)
+                                        {
+                                                if (predicate(first, b->content[j])) callback(first, b->content[j]);
+                                        }
+                                }
+                                return;
+                        }
+
+                        const vec2 extent_a = a->region.TopRight() - a->region.BottomLeft();
+                        const vec2 extent_b = b->region.TopRight() - b->region.BottomLeft();
+                        if (b->children == nullptr || (a->children != nullptr && extent_a.x * extent_a.y >= extent_b.x * extent_b.y))
+                        {
+                                for (size_t k = 0; k < 4; ++k) join(&a->children[k], b, predicate, callback);
+                        }
+                        else
+                        {
+                                for (size_t k = 0; k < 4; ++k) join(a, &b->children[k], predicate, callback);
+                        }
+                }
+
+                void free(QuadTreeNode* node)
+                {
+                        if (node->children != nullptr) // internal node
+                        {
+                                for (size_t k = 0; k < 4; ++k) free(&node->children[k]);
+                                node_alloc.deallocate(node->children, 4);
+                        }
+                        else // leaf node
+                        {
+                                deallocate_leaf(node);
+                        }
+                }
+
+                struct keyed_t
+                {
+                        unsigned int key;
+                        unsigned int slot;
+                        const type_p* item;
+                };
+
+                // Output iterator ignoring the handles of bulk loaded elements
+                struct NoHandles
+                {
+                        NoHandles& operator*() { return *this; }
+                        NoHandles& operator++() { return *this; }
+                        NoHandles& operator++(int) { return *this; }
+                        NoHandles& operator=(const QuadTreeHandle&) { return *this; }
+                };
+
+                // Emits the subtree for a range of elements sorted by Morton key, every leaf is allocated exactly once
+                void build(QuadTreeNode* node, const keyed_t* first, const keyed_t* last)
+                {
+                        const size_t count = last - first;
+                        node->children = nullptr;
+                        node->changed = true;
+                        node->size = 0;
+                        node->count = count;
+
+                        if (count < node_capacity || node->depth == max_depth) // leaf node
+                        {
+                                allocate_leaf(node, (count / node_capacity + 1) * node_capacity);
+                                for (; first != last; ++first) store(node, node->size++, *first->item, first->slot);
+                                summarize(node, node->parent);
+                                return;
+                        }
+
+                        // Internal node, the quadrant of each element is given by two bits of its key
+                        const unsigned int shift = 2 * (max_depth - 1 - node->depth);
+                        make_children(node);
+                        for (unsigned int k = 0; k < 4; ++k)
+                        {
+                                const keyed_t* split = first;
+                                while (split != last && ((split->key >> shift) & 3) == k) ++split;
+                                build(&node->children[k], first, split);
+                                first = split;
+                        }
+                        summarize(node, node->parent);
+                }
+
+                // Turns node into an internal node, the bulk loaders fill in the rest of the children
+                void make_children(QuadTreeNode* node)
+                {
+                        node->capacity = 0;
+                        node->content = nullptr;
+                        node->positions = nullptr;
+                        node->slot_ids = nullptr;
+                        node->children = node_alloc.allocate(4, node);
+                        for (unsigned int k = 0; k < 4; ++k)
+                        {
+                                QuadTreeNode* child = &node->children[k];
+                                child->parent = node;
+                                child->depth = node->depth + 1;
+                                child->region = node->region.Quadrant(k);
+                        }
+                }
+
+                static bool key_order(const keyed_t& a, const keyed_t& b)
+                {
+                        return a.key < b.key;
+                }
+
+                // Subtrees with fewer elements are sorted and built by the task that reached them
+                static const size_t parallel_grain = 4096;
+
+                // Partitions the range by quadrant and builds the four children as separate tasks, a parallel MSD radix sort fused with the build
+                void build_parallel(QuadTreeNode* node, keyed_t* first, keyed_t* last, ThreadPool& pool, TaskGroup& group)
+                {
+                        const size_t count = last - first;
+                        if (count < parallel_grain || count < node_capacity || node->depth == max_depth)
+                        {
+                                std::sort(first, last, key_order);
+                                build(node, first, last);
+                                return;
+                        }
+
+                        // West before east, then south before north, which is the order of the children
+                        const unsigned int shift = 2 * (max_depth - 1 - node->depth);
+                        keyed_t* split[5];
+                        split[0] = first;
+                        split[4] = last;
+                        split[2] = std::partition(first, last, [shift](const keyed_t& entry) { return ((entry.key >> shift) & 2) == 0; });
+                        split[1] = std::partition(first, split[2], [shift](const keyed_t& entry) { return ((entry.key >> shift) & 1) == 0; });
+                        split[3] = std::partition(split[2], last, [shift](const keyed_t& entry) { return ((entry.key >> shift) & 1) == 0; });
+
+                        node->children = nullptr;
+                        node->changed = true;
+                        node->size = 0;
+                        node->count = count;
+                        make_children(node);
+                        for (unsigned int k = 0; k < 4; ++k)
+                        {
+                                QuadTreeNode* child = &node->children[k];
+                                keyed_t* begin = split[k];
+                                keyed_t* end = split[k + 1];
+                                if (size_t(end - begin) < parallel_grain) build_parallel(child, begin, end, pool, group);
+                                else pool.Run(group, [this, child, begin, end, &pool, &group] { build_parallel(child, begin, end, pool, group); });
+                        }
+                }
+
+                template <typename iterator>
+                static void bounds(iterator first, iterator last, vec2& sw, vec2& ne)
+                {
+                        for (iterator it = first; it != last; ++it)
+                        {
+                                const vec2& point = it->Position();
+                                sw.x = std::min(sw.x, point.x); sw.y = std::min(sw.y, point.y);
+                                ne.x = std::max(ne.x, point.x); ne.y = std::max(ne.y, point.y);
+                        }
+                }
+
+                // Degenerate regions would make expansion impossible later on
+                static AABB bounding_region(vec2 sw, vec2 ne)
+                {
+                        if (ne.x == sw.x) ne.x += 1.0f;
+                        if (ne.y == sw.y) ne.y += 1.0f;
+                        return AABB(sw, ne);
+                }
+
+                template <typename iterator, typename handle_iterator>
+                void build_root(iterator first, iterator last, handle_iterator handles)
+                {
+                        // Compute the bounding region once
+                        if (first != last)
+                        {
+                                vec2 sw = first->Position();
+                                vec2 ne = sw;
+                                bounds(first, last, sw, ne);
+                                root.region = bounding_region(sw, ne);
+                        }
+
+                        std::vector<keyed_t> keyed;
+                        for (iterator it = first; it != last; ++it)
+                        {
+                                keyed_t entry = {util::MortonKey(root.region, it->Position(), max_depth), acquire_slot(), &*it};
+                                keyed.push_back(entry);
+                                *handles++ = handle(entry.slot);
+                        }
+                        std::sort(keyed.begin(), keyed.end(), key_order);
+
+                        root.parent = nullptr;
+                        root.depth = 0;
+                        build(&root, keyed.data(), keyed.data() + keyed.size());
+                }
+
+                // Appends the subtree to the snapshot, the entry at index has already been reserved for it
+                void snapshot(snapshot_t& target, const QuadTreeNode* node, size_t index) const
+                {
+                        typename snapshot_t::Node entry;
+                        entry.region = node->region;
+                        entry.children = 0;
+                        entry.first = static_cast<unsigned int>(target.elements.size());
+                        entry.count = static_cast<unsigned int>(node->count);
+
+                        if (node->children != nullptr) // internal node
+                        {
+                                entry.children = static_cast<unsigned int>(target.nodes.size());
+                                target.nodes.resize(target.nodes.size() + 4);
+                                target.nodes[index] = entry;
+                                for (size_t k = 0; k < 4; ++k) snapshot(target, &node->children[k], entry.children + k);
+                        }
+                        else // leaf node
+                        {
+                                target.nodes[index] = entry;
+                                target.elements.insert(target.elements.end(), node->content, node->content + node->size);
+                        }
+                }
+
+                // Subtrees holding at most this many elements are published as a single piece
+                static const size_t publish_grain = 256;
+
+                // Lays out the subtree for Publish, the entry at index has already been reserved for it
+                void publish(shared_snapshot_t& target, QuadTreeNode* node, size_t index)
+                {
+                        FlatNode entry;
+                        entry.region = node->region;
+                        entry.children = 0;
+                        entry.count = static_cast<unsigned int>(node->count);
+
+                        if (node->children == nullptr || node->count <= publish_grain) // piece, copied again only if something changed in it
+                        {
+                                std::shared_ptr<const snapshot_t>& piece = fresh_pieces[node];
+                                typename std::unordered_map<const QuadTreeNode*, std::shared_ptr<const snapshot_t>>::iterator found = pieces.end();
+                                if (!node->changed) found = pieces.find(node);
+
+                                if (found != pieces.end()) piece = found->second;
+                                else
+                                {
+                                        std::shared_ptr<snapshot_t> copy = std::make_shared<snapshot_t>();
+                                        copy->elements.reserve(node->count);
+                                        copy->nodes.resize(1);
+                                        snapshot(*copy, node, 0);
+                                        piece = copy;
+                                        settle(node);
+                                }
+
+                                entry.first = static_cast<unsigned int>(target.pieces.size());
+                                target.pieces.push_back(piece);
+                                target.nodes[index] = entry;
+                                return;
+                        }
+
+                        entry.first = 0;
+                        entry.children = static_cast<unsigned int>(target.nodes.size());
+                        target.nodes.resize(target.nodes.size() + 4);
+                        target.nodes[index] = entry;
+                        node->changed = false;
+                        for (unsigned int k = 0; k < 4; ++k) publish(target, &node->children[k], entry.children + k);
+                }
+
+                // Clears the flags of a subtree that has just been copied, subtrees not flagged have nothing flagged below them
+                static void settle(QuadTreeNode* node)
+                {
+                        if (!node->changed) return;
+                        node->changed = false;
+                        if (node->children != nullptr)
+                        {
+                                for (size_t k = 0; k < 4; ++k) settle(&node->children[k]);
+                        }
+                }
+
+                // Rebuilds the subtree from the node at index of an image, the structure is taken as it is rather than recomputed
+                template <typename handle_iterator>
+                void load(QuadTreeNode* node, const unsigned char* data, const util::ImageHeader& header, unsigned int index, handle_iterator& handles)
+                {
+                        const FlatNode entry = util::ImageNode(data, header, index);
+                        node->children = nullptr;
+                        node->changed = true;
+                        node->size = 0;
+                        node->count = entry.count;
+                        node->region = entry.region;
+
+                        if (entry.children == 0) // leaf node, the elements may not be aligned for type_p inside the image
+                        {
+                                allocate_leaf(node, (entry.count / node_capacity + 1) * node_capacity);
+                                const unsigned char* source = data + header.element_offset + size_t(entry.first) * sizeof(type_p);
+                                for (unsigned int k = 0; k < entry.count; ++k, source += sizeof(type_p))
+                                {
+                                        type_p item;
+                                        std::memcpy(&item, source, sizeof(type_p));
+                                        unsigned int slot = acquire_slot();
+                                        store(node, node->size++, item, slot);
+                                        *handles++ = handle(slot);
+                                }
+                                summarize(node, node->parent);
+                                return;
+                        }
+
+                        make_children(node);
+                        for (unsigned int k = 0; k < 4; ++k) load(&node->children[k], data, header, entry.children + k, handles);
+                        summarize(node, node->parent);
+                }
+
+                void init_root(const AABB& region)
+                {
+                        root.region = region;
+                        root.size = 0;
+                        root.count = 0;
+                        root.aggregate = aggregate_policy::Identity();
+                        root.children = nullptr;
+                        root.parent = nullptr;
+                        root.depth = 0;
+                        root.changed = true;
+                        allocate_leaf(&root, node_capacity);
+                }
+
+        public:
+
+                explicit QuadTree(const AABB& region, const size_t capacity_hint = 10U) :
+                        node_capacity(capacity_hint), free_slot(no_slot), published(nullptr)
+                {
+                        ResetQueryCounters();
+                        init_root(region);
+
+                }
+
+                explicit QuadTree(const AABB& region, allocator_type& allocator, const size_t capacity_hint = 10U) :
+                        node_capacity(capacity_hint), node_alloc(allocator), vec_alloc(allocator), float_alloc(allocator), index_alloc(allocator),
+                        free_slot(no_slot), published(nullptr)
+                {
+                        ResetQueryCounters();
+                        init_root(region);
+                }
+
+                // Bulk load constructors, the region is the bounding box of the elements
+                template <typename iterator>
+                QuadTree(iterator first, iterator last, const size_t capacity_hint = 10U) :
+                        node_capacity(capacity_hint), free_slot(no_slot), published(nullptr)
+                {
+                        ResetQueryCounters();
+                        root.region = AABB(vec2(0.0f, 0.0f), vec2(1.0f, 1.0f));
+                        build_root(first, last, NoHandles());
+                }
+
+                template <typename iterator>
+                QuadTree(iterator first, iterator last, allocator_type& allocator, const size_t capacity_hint = 10U) :
+                        node_capacity(capacity_hint), node_alloc(allocator), vec_alloc(allocator), float_alloc(allocator), index_alloc(allocator),
+                        free_slot(no_slot), published(nullptr)
+                {
+                        ResetQueryCounters();
+                        root.region = AABB(vec2(0.0f, 0.0f), vec2(1.0f, 1.0f));
+                        build_root(first, last, NoHandles());
+                }
+
+                virtual ~QuadTree()
+                {
+                        free(&root);
+                }
+
+                /*
+                Description: replaces the contents of the tree with a range of elements in a single pass
+                Remark: the iterators must be forward iterators referencing type_p lvalues, previously returned pointers and handles are invalidated
+                Remark: the region shrinks to the bounding box of the elements, an empty range keeps the current region
+                */
+                template <typename iterator>
+                void Build(iterator first, iterator last)
+                {
+                        Build(first, last, NoHandles());
+                }
+
+                // Same as above, the handle of every element is written to the output iterator in input order
+                template <typename iterator, typename handle_iterator>
+                void Build(iterator first, iterator last, handle_iterator handles)
+                {
+                        free(&root);
+                        release_slots();
+                        build_root(first, last, handles);
+                }
+
+                /*
+                Description: same as Build, but the bounding region, the keys and the subtrees are computed by the tasks of a thread pool
+                Remark: the iterators must be random access iterators, the allocator must be safe to use from several threads (std::allocator and CachingPoolAllocator are, SmartPoolAllocator isn't)
+                */
+                template <typename iterator>
+                void ParallelBuild(iterator first, iterator last, ThreadPool& pool)
+                {
+                        ParallelBuild(first, last, pool, NoHandles());
+                }
+
+                template <typename iterator, typename handle_iterator>
+                void ParallelBuild(iterator first, iterator last, ThreadPool& pool, handle_iterator handles)
+                {
+                        free(&root);
+                        release_slots();
+
+                        const size_t count = last - first;
+                        const size_t chunk = std::max(size_t(parallel_grain), count / (4 * pool.Size()) + 1);
+                        const size_t chunks = (count + chunk - 1) / chunk;
+                        TaskGroup group;
+
+                        // Bounding region, each chunk computes its own box
+                        if (count > 0)
+                        {
+                                std::vector<vec2> sw(chunks), ne(chunks);
+                                for (size_t c = 0; c < chunks; ++c)
+                                {
+                                        pool.Run(group, [&, c]
+                                        {
+                                                iterator begin = first + c * chunk;
+                                                sw[c] = ne[c] = begin->Position();
+                                                bounds(begin, first + std::min(count, (c + 1) * chunk), sw[c], ne[c]);
+                                        });
+                                }
+                                pool.Wait(group);
+
+                                for (size_t c = 1; c < chunks; ++c)
+                                {
+                                        sw[0].x = std::min(sw[0].x, sw[c].x); sw[0].y = std::min(sw[0].y, sw[c].y);
+                                        ne[0].x = std::max(ne[0].x, ne[c].x); ne[0].y = std::max(ne[0].y, ne[c].y);
+                                }
+                                root.region = bounding_region(sw[0], ne[0]);
+                        }
+
+                        // Slots are handed out in input order, the keys are computed in parallel
+                        std::vector<keyed_t> keyed(count);
+                        for (size_t k = 0; k < count; ++k)
+                        {
+                                keyed[k].slot = acquire_slot();
+                                *handles++ = handle(keyed[k].slot);
+                        }
+                        for (size_t c = 0; c < chunks; ++c)
+                        {
+                                pool.Run(group, [&, c]
+                                {
+                                        for (size_t k = c * chunk; k < std::min(count, (c + 1) * chunk); ++k)
+                                        {
+                                                keyed[k].key = util::MortonKey(root.region, first[k].Position(), max_depth);
+                                                keyed[k].item = &first[k];
+                                        }
+                                });
+                        }
+                        pool.Wait(group);
+
+                        root.parent = nullptr;
+                        root.depth = 0;
+                        build_parallel(&root, keyed.data(), keyed.data() + count, pool, group);
+                        pool.Wait(group);
+
+                        // Only the subtrees built by a single task have their summaries, the nodes above them are split by build_parallel
+                        summarize_subtree(&root, parallel_grain);
+                }
+
+                QuadTreeHandle Insert(const type_p& item)
+                {
+                        // If inserting outside of the region expansion is required
+                        enclose(item.Position());
+
+                        // Descend to the appropriate leaf
                         QuadTreeNode* current = &root;
                         descend(current, item.Position());
-                        remove(current, element);
+
+                        // Perform the operation
+                        unsigned int slot = acquire_slot();
+                        insert(current, &item, slot);
+                        propagate(current->parent, nullptr, 1);
+                        summarize(current, nullptr);
+                        return handle(slot);
+                }
+
+                // Current location of the element, nullptr if it has been removed
+                type_p* Get(QuadTreeHandle handle) const
+                {
+                        const Slot* slot = resolve(handle);
+                        return slot != nullptr ? &slot->node->content[slot->offset] : nullptr;
+                }
+
+                template <typename alloc = std::allocator<type_p*>>
+                std::vector<type_p*, alloc> Query(const AABB& region) const
+                {
+                        std::vector<type_p*, alloc> results;
+                        auto callback = [&results](type_p& item) { results.emplace_back(&item); };
+                        auto reserve = [&results](size_t count) // keeps the growth geometric
+                        {
+                                size_t required = results.size() + count;
+                                if (required > results.capacity()) results.reserve(std::max(required, 2 * results.capacity()));
+                        };
+
+                        if (root.region.Intersect(region))
+                                for_each(region, &root, callback, reserve);
+                        return results;
+                }
+
+                // Writes a pointer to every element inside the region to the output iterator, returns the iterator past the last one written
+                template <typename output_iterator>
+                output_iterator Query(const AABB& region, output_iterator out) const
+                {
+                        ForEachInRegion(region, [&out](type_p& item) { *out++ = &item; });
+                        return out;
+                }
+
+                /*
+                Description: fills a caller provided buffer with pointers to the elements inside the region
+                Remark: returns the total number of elements found, only the first capacity of them are written
+                */
+                size_t Query(const AABB& region, type_p** buffer, size_t capacity) const
+                {
+                        size_t count = 0;
+                        ForEachInRegion(region, [&](type_p& item)
+                        {
+                                if (count < capacity) buffer[count] = &item;
+                                ++count;
+                        });
+                        return count;
+                }
+
+                // Invokes callback(type_p&) for every element inside the region without allocating
+                template <typename callback_type>
+                void ForEachInRegion(const AABB& region, callback_type callback) const
+                {
+                        NoReserve reserve;
+                        if (root.region.Intersect(region))
+                                for_each(region, &root, callback, reserve);
+                }
+
+                /*
+                Description: number of elements inside the region, without visiting the elements of the nodes it covers entirely
+                Remark: the work is proportional to the nodes along the border of the region rather than to the result
+                */
+                size_t Count(const AABB& region) const
+                {
+                        size_t count = 0;
+                        auto whole = [&count](const QuadTreeNode* node) { count += node->count; };
+                        auto partial = [&count](const type_p&) { ++count; };
+                        if (root.region.Intersect(region))
+                                cover(region, &root, whole, partial);
+                        return count;
+                }
+
+                /*
+                Description: combined summary of the elements inside the region, as defined by the aggregate_policy of the traits
+                Remark: nodes inside the region contribute their cached summary, only the leaves on its border combine their elements one by one
+                Remark: with the default NoAggregate policy the result is an empty value
+                */
+                aggregate_t Aggregate(const AABB& region) const
+                {
+                        aggregate_t result = aggregate_policy::Identity();
+                        auto whole = [&result](const QuadTreeNode* node) { result = aggregate_policy::Combine(result, node->aggregate); };
+                        auto partial = [&result](const type_p& item) { result = aggregate_policy::Combine(result, aggregate_policy::Of(item)); };
+                        if (root.region.Intersect(region))
+                                cover(region, &root, whole, partial);
+                        return result;
+                }
+
+                /*
+                Description: invokes callback(type_p&) for every element inside the shape, see Shapes.h for Circle, ConvexPolygon and OrientedBox
+                Remark: nodes entirely inside the shape are accepted without testing their points, nodes outside of it are skipped
+                */
+                template <typename shape_type, typename callback_type>
+                void ForEachInShape(const shape_type& shape, callback_type callback) const
+                {
+                        shape_for_each(shape, &root, callback);
+                }
+
+                template <typename shape_type, typename alloc = std::allocator<type_p*>>
+                std::vector<type_p*, alloc> QueryShape(const shape_type& shape) const
+                {
+                        std::vector<type_p*, alloc> results;
+                        auto callback = [&results](type_p& item) { results.emplace_back(&item); };
+                        shape_for_each(shape, &root, callback);
+                        return results;
+                }
+
+                /*
+                Description: runs count queries at once, the results of regions[i] end up in results[offsets[i]] to results[offsets[i + 1] - 1]
+                Remark: the queries are executed in Morton order of their centers, each one resumes from the deepest node of the previous one's path that still encloses it
+                Remark: both vectors are overwritten, reusing them between calls avoids allocations once they're large enough
+                */
+                void QueryBatch(const AABB* regions, size_t count, std::vector<size_t>& offsets, std::vector<type_p*>& results) const
+                {
+                        std::vector<std::pair<unsigned int, size_t>> order(count);
+                        for (size_t k = 0; k < count; ++k)
+                                order[k] = std::make_pair(util::MortonKey(root.region, regions[k].Center(), max_depth), k);
+                        std::sort(order.begin(), order.end());
+
+                        // Results are gathered in execution order first, then scattered to the order of the regions
+                        std::vector<type_p*> found;
+                        auto callback = [&found](type_p& item) { found.emplace_back(&item); };
+                        auto reserve = [&found](size_t count)
+                        {
+                                size_t required = found.size() + count;
+                                if (required > found.capacity()) found.reserve(std::max(required, 2 * found.capacity()));
+                        };
+
+                        offsets.assign(count + 1, 0);
+                        std::vector<const QuadTreeNode*> path(1, &root);
+                        for (const std::pair<unsigned int, size_t>& entry : order)
+                        {
+                                const AABB& region = regions[entry.second];
+                                while (path.size() > 1 && !encloses(path.back()->region, region)) path.pop_back();
+
+                                // Descend as long as a single child encloses the whole region
+                                for (const QuadTreeNode* node = path.back(); node->children != nullptr; node = path.back())
+                                {
+                                        size_t k = 0;
+                                        while (k < 4 && !encloses(node->children[k].region, region)) ++k;
+                                        if (k == 4) break;
+                                        path.push_back(&node->children[k]);
+                                }
+
+                                const QuadTreeNode* node = path.back();
+                                const size_t before = found.size();
+                                if (node->count != 0 && node->region.Intersect(region))
+                                        for_each(region, node, callback, reserve);
+                                offsets[entry.second + 1] = found.size() - before;
+                        }
+
+                        for (size_t k = 0; k < count; ++k) offsets[k + 1] += offsets[k];
+                        results.resize(found.size());
+                        size_t position = 0;
+                        for (const std::pair<unsigned int, size_t>& entry : order)
+                        {
+                                const size_t first = offsets[entry.second], length = offsets[entry.second + 1] - first;
+                                std::copy(found.begin() + position, found.begin() + position + length, results.begin() + first);
+                                position += length;
+                        }
+                }
+
+                /*
+                Description: same as ForEachInRegion, but the subtrees below the first levels are walked concurrently by the pool's workers
+                Remark: callback is invoked from several threads at once and must be safe to call concurrently, the calling thread helps until every subtree is done
+                Remark: the tree must not be modified until it returns
+                */
+                template <typename callback_type>
+                void ParallelForEachInRegion(const AABB& region, ThreadPool& pool, callback_type callback) const
+                {
+                        std::vector<const QuadTreeNode*> tasks;
+                        fan_out(region, pool, tasks);
+
+                        TaskGroup group;
+                        for (const QuadTreeNode* node : tasks)
+                        {
+                                pool.Run(group, [this, &region, node, &callback]
+                                {
+                                        NoReserve reserve;
+                                        for_each(region, node, callback, reserve);
+                                });
+                        }
+                        pool.Wait(group);
+                }
+
+                /*
+                Description: same as Query, but the subtrees below the first levels are walked concurrently by the pool's workers
+                Remark: every subtree fills its own buffer, the buffers are concatenated once all of them are done, so the order differs from Query's
+                */
+                template <typename alloc = std::allocator<type_p*>>
+                std::vector<type_p*, alloc> ParallelQuery(const AABB& region, ThreadPool& pool) const
+                {
+                        std::vector<type_p*, alloc> results;
+                        std::vector<const QuadTreeNode*> tasks;
+                        fan_out(region, pool, tasks);
+                        if (tasks.empty()) return results;
+
+                        std::vector<std::vector<type_p*>> buffers(tasks.size());
+                        TaskGroup group;
+                        for (size_t k = 0; k < tasks.size(); ++k)
+                        {
+                                pool.Run(group, [this, &region, &tasks, &buffers, k]
+                                {
+                                        std::vector<type_p*>& buffer = buffers[k];
+                                        auto callback = [&buffer](type_p& item) { buffer.emplace_back(&item); };
+                                        auto reserve = [&buffer](size_t count)
+                                        {
+                                                size_t required = buffer.size() + count;
+                                                if (required > buffer.capacity()) buffer.reserve(std::max(required, 2 * buffer.capacity()));
+                                        };
+                                        for_each(region, tasks[k], callback, reserve);
+                                });
+                        }
+                        pool.Wait(group);
+
+                        size_t total = 0;
+                        for (const std::vector<type_p*>& buffer : buffers) total += buffer.size();
+                        results.reserve(total);
+                        for (const std::vector<type_p*>& buffer : buffers) results.insert(results.end(), buffer.begin(), buffer.end());
+                        return results;
+                }
+
+                // Returns up to k elements closest to the point, sorted by increasing distance
+                std::vector<type_p*> Nearest(const vec2& point, size_t k) const
+                {
+                        std::vector<type_p*> results;
+                        nearest(results, point, k, std::numeric_limits<float>::infinity());
+                        return results;
+                }
+
+                // Returns the elements within radius of the point, closest first, optionally limited to the k closest ones, a negative radius finds nothing
+                std::vector<type_p*> NearestWithin(const vec2& point, float radius, size_t k = std::numeric_limits<size_t>::max()) const
+                {
+                        std::vector<type_p*> results;
+                        if (radius < 0.0f) return results;
+                        nearest(results, point, k, radius * radius);
+                        return results;
+                }
+
+                /*
+                Description: walks the leaves crossed by the ray front to back, invoking callback(type_p&, float distance) until it returns true for a hit
+                Remark: distance is the element's projection along the ray, the elements of a leaf are offered closest first and only leaves the ray crosses are tested
+                Remark: leaves are visited in the order the ray enters them, so an element off to the side of a later leaf may project closer than one of an earlier leaf
+                Remark: returns true if the callback reported a hit, the direction doesn't have to be normalized
+                */
+                template <typename callback_type>
+                bool Raycast(const vec2& origin, const vec2& direction, float max_distance, callback_type callback) const
+                {
+                        const float length = std::sqrt(direction.x * direction.x + direction.y * direction.y);
+                        if (length == 0.0f || root.count == 0) return false;
+
+                        const vec2 unit = direction / length;
+                        float enter, exit;
+                        if (!crossing_interval(root.region, origin, unit, max_distance, enter, exit)) return false;
+
+                        std::vector<ray_entry> spill;
+                        return raycast(&root, origin, unit, max_distance, callback, spill);
+                }
+
+                // Same as Raycast, limited to the segment between the two points
+                template <typename callback_type>
+                bool SegmentCast(const vec2& from, const vec2& to, callback_type callback) const
+                {
+                        const vec2 direction = to - from;
+                        return Raycast(from, direction, std::sqrt(direction.x * direction.x + direction.y * direction.y), callback);
+                }
+
+                /*
+                Description: invokes callback(type_p&, type_p&) once for every unordered pair of elements at most distance apart
+                Remark: a single traversal pairs each leaf with itself and with the leaves within distance of it, no element is paired with itself
+                Remark: a negative distance accepts no pair, the callback isn't invoked
+                */
+                template <typename callback_type>
+                void ForEachPairWithin(float distance, callback_type callback) const
+                {
+                        if (distance < 0.0f) return;
+                        pairs(&root, distance * distance, callback);
+                }
+
+                /*
+                Description: invokes callback(type_p&, other_p&) for every pair of an element of this tree and one of the other tree accepted by the predicate
+                Remark: predicate(const AABB&, const AABB&) decides whether two nodes may hold accepted pairs, predicate(const type_p&, const other_p&) tests the elements, see WithinDistance
+                Remark: both trees are descended together, so the cost follows the overlapping parts of the trees rather than the size of either of them
+                */
+                template <typename other_p, typename other_allocator, typename other_traits, typename predicate_type, typename callback_type>
+                void Join(const QuadTree<other_p, other_allocator, other_traits>& other, predicate_type predicate, callback_type callback) const
+                {
+                        join(&root, &other.root, predicate, callback);
                 }
 
+                void Remove(QuadTreeHandle handle)
+                {
+                        const Slot* slot = resolve(handle);
+                        if (slot == nullptr) return;
+
+                        QuadTreeNode* current = slot->node;
+                        remove(current, slot->offset);
+                        propagate(current->parent, nullptr, -1);
+                        summarize(current, nullptr);
+                        release_slot(handle.index);
+                        shrink(current);
+                }
+
+                // Does nothing if the element isn't in the tree
+                void Remove(type_p* element)
+                {
+                        QuadTreeNode* current = locate(element);
+                        if (current == nullptr) return;
+
+                        size_t index = element - current->content;
+                        unsigned int slot = current->slot_ids[index];
+                        remove(current, index);
+                        propagate(current->parent, nullptr, -1);
+                        summarize(current, nullptr);
+                        release_slot(slot);
+                        shrink(current);
+                }
+
+                // Returns the element's new location, nullptr if the handle is no longer valid
+                type_p* Move(QuadTreeHandle handle, const vec2& to)
+                {
+                        const Slot* slot = resolve(handle);
+                        if (slot == nullptr) return nullptr;
+                        return move(slot->node, slot->offset, to);
+                }
+
+                /*
+                Description: moves a batch of elements, handles[k] is moved to positions[k]
+                Remark: elements staying inside their leaf are updated in place, only those crossing a leaf boundary are taken out and reinserted in Morton order
+                Remark: invalid handles are ignored
+                */
+                void MoveAll(const QuadTreeHandle* handles, const vec2* positions, size_t count)
+                {
+                        // Update in place, remembering the elements that left their leaf
+                        crossing.clear();
+                        for (size_t k = 0; k < count; ++k)
+                        {
+                                const Slot* slot = resolve(handles[k]);
+                                if (slot == nullptr) continue;
+
+                                // Same rule as move, an element stays in its leaf as long as the leaf's region contains it
+                                QuadTreeNode* leaf = slot->node;
+                                if (leaf->region.Inside(positions[k]))
+                                {
+                                        update(leaf, slot->offset, positions[k]);
+                                        continue;
+                                }
+                                leaf->content[slot->offset].Position(positions[k]);
+                                crossing.push_back(handles[k].index);
+                        }
+                        if (crossing.empty()) return;
+
+                        // Take them out, their slots stay reserved but point nowhere until they're reinserted
+                        pending.clear();
+                        for (size_t k = 0; k < crossing.size(); ++k)
+                        {
+                                Slot& slot = slots[crossing[k]];
+                                QuadTreeNode* leaf = slot.node;
+                                if (leaf == nullptr) continue; // the same handle was listed more than once
+
+                                Pending entry = {0, crossing[k], leaf->content[slot.offset]};
+                                pending.push_back(entry);
+                                remove(leaf, slot.offset);
+                                slot.node = nullptr;
+                                propagate(leaf->parent, nullptr, -1);
+                                summarize(leaf, nullptr);
+                                shrink(leaf);
+                        }
+
+                        // Grow the region first so every key is computed against the final root
+                        for (size_t k = 0; k < pending.size(); ++k)
+                                enclose(pending[k].item.Position());
+                        for (size_t k = 0; k < pending.size(); ++k)
+                                pending[k].key = util::MortonKey(root.region, pending[k].item.Position(), max_depth);
+                        std::sort(pending.begin(), pending.end(), [](const Pending& a, const Pending& b) { return a.key < b.key; });
+
+                        // Consecutive elements share most of their path, so each descent starts where the previous one ended
+                        QuadTreeNode* current = &root;
+                        for (size_t k = 0; k < pending.size(); ++k)
+                        {
+                                const vec2& point = pending[k].item.Position();
+                                ascend(current, point);
+                                descend(current, point);
+                                insert(current, &pending[k].item, pending[k].slot);
+                                propagate(current->parent, nullptr, 1);
+                                summarize(current, nullptr);
+                        }
+                }
+
+                // Returns the element's new location, nullptr if the element isn't in the tree
                 type_p* Move(type_p* element, const vec2& to)
                 {
-                        QuadTreeNode* source = &root;
-                        QuadTreeNode* destination;
+                        QuadTreeNode* source = locate(element);
+                        return source != nullptr ? move(source, element - source->content, to) : nullptr;
+                }
 
-                        // Go to the point
-                        descend(source, element->Position());
+                // Copies the current contents into a flat immutable snapshot, reusing its memory
+                void Snapshot(snapshot_t& target) const
+                {
+                        target.nodes.clear();
+                        target.elements.clear();
+                        target.elements.reserve(root.count);
+                        target.nodes.resize(1);
+                        snapshot(target, &root, 0);
+                }
 
-                        // Move back up until it's in range
-                        destination = source;
-                        ascend(destination, to);
+                /*
+                Description: writes the tree to a binary image, see QuadTreeImage.h for the format, returns false if the file couldn't be written
+                Remark: the image can be read back by Load or queried in place by QuadTreeView, type_p must be trivially copyable
+                */
+                bool Save(const char* path) const
+                {
+                        static_assert(std::is_trivially_copyable<type_p>::value, "QuadTree images hold the bytes of their elements, type_p must be trivially copyable");
+                        snapshot_t flat;
+                        Snapshot(flat);
+                        return util::WriteImage(path, flat.nodes.data(), flat.nodes.size(), flat.elements.data(), flat.elements.size(), sizeof(type_p));
+                }
 
-                        // If it's inside the same region, just update its position
-                        if (destination == source)
+                /*
+                Description: replaces the contents of the tree with an image written by Save, the nodes are rebuilt as they were saved
+                Remark: returns false and leaves the tree untouched if the file can't be read or isn't a valid image for type_p, the checksum is always verified
+                Remark: previously returned pointers and handles are invalidated, the handles of the loaded elements are written to the output iterator in depth first order
+                */
+                bool Load(const char* path)
+                {
+                        return Load(path, NoHandles());
+                }
+
+                template <typename handle_iterator>
+                bool Load(const char* path, handle_iterator handles)
+                {
+                        static_assert(std::is_trivially_copyable<type_p>::value, "QuadTree images hold the bytes of their elements, type_p must be trivially copyable");
+                        MappedFile file;
+                        util::ImageHeader header;
+                        if (!file.Open(path) || !util::ReadImage(file.Data(), file.Size(), sizeof(type_p), header, true)) return false;
+
+                        free(&root);
+                        release_slots();
+                        root.parent = nullptr;
+                        root.depth = 0;
+                        load(&root, file.Data(), header, 0, handles);
+                        return true;
+                }
+
+                /*
+                Description: makes the current contents visible to readers, call it from the writer thread once a batch of changes is complete
+                Remark: only the subtrees that changed since the last Publish are copied, the others are shared with the snapshots published before
+                Remark: changes made to elements through the pointers the tree hands out aren't seen, moving an element to where it is has it copied again
+                */
+                void Publish()
+                {
+                        // Every access to the counters and to published is sequentially consistent, so a reader either sees that the version
+                        // it loaded isn't published anymore or has its count seen here
+                        Version* current = published.load();
+                        Version* target = nullptr;
+                        for (size_t k = 0; k < versions.size() && target == nullptr; ++k)
                         {
-                                element->Position(to);
-                                return element;
+                                if (versions[k].get() != current && versions[k]->readers.load() == 0) target = versions[k].get();
+                        }
+                        if (target == nullptr)
+                        {
+                                versions.emplace_back(new Version());
+                                target = versions.back().get();
                         }
 
-                        // Go to the leaf node containing the destination point
-                        descend(destination, to);
+                        shared_snapshot_t& snapshot = target->snapshot;
+                        snapshot.nodes.clear();
+                        snapshot.pieces.clear();
+                        snapshot.nodes.resize(1);
+                        publish(snapshot, &root, 0);
+                        pieces.swap(fresh_pieces);
+                        fresh_pieces.clear();
+                        published.store(target);
+                }
 
-                        // Update its position, remove from source and insert in destination
-                        element->Position(to);
-                        type_p* new_element = insert(destination, element);
-                        remove(source, element);
-                        return new_element;
+                /*
+                Description: read access to a published snapshot, the snapshot isn't modified or reclaimed until the reader is destroyed
+                Remark: readers must be destroyed before the tree
+                */
+                class Reader
+                {
+                        friend class QuadTree;
+                        Version* version;
+
+                        explicit Reader(Version* version) : version(version)
+                        {}
+
+                public:
+
+                        Reader(Reader&& other) : version(other.version)
+                        {
+                                other.version = nullptr;
+                        }
+
+                        Reader& operator=(Reader&& other)
+                        {
+                                std::swap(version, other.version);
+                                return *this;
+                        }
+
+                        Reader(const Reader&) = delete;
+                        Reader& operator=(const Reader&) = delete;
+
+                        ~Reader()
+                        {
+                                if (version != nullptr) version->readers.fetch_sub(1);
+                        }
+
+                        const shared_snapshot_t& operator*() const
+                        {
+                                return version->snapshot;
+                        }
+
+                        const shared_snapshot_t* operator->() const
+                        {
+                                return &version->snapshot;
+                        }
+
+                        explicit operator bool() const
+                        {
+                                return version != nullptr;
+                        }
+                };
+
+                // Latest published snapshot, empty before the first Publish, lock free and safe to call from any thread while the writer keeps working
+                Reader Acquire() const
+                {
+                        // Only retries when the writer published in between
+                        for (;;)
+                        {
+                                Version* version = published.load();
+                                if (version == nullptr) return Reader(nullptr);
+
+                                version->readers.fetch_add(1);
+                                if (published.load() == version) return Reader(version);
+                                version->readers.fetch_sub(1);
+                        }
                 }
 
                 const AABB& Region() const
@@ -367,8 +2140,45 @@ namespace ORC_NAMESPACE
                         return root.region;
                 }
 
+                size_t Size() const
+                {
+                        return root.count;
+                }
+
+                // Walks the whole tree, meant for diagnostics rather than every frame
+                QuadTreeStats Stats() const
+                {
+                        QuadTreeStats result = QuadTreeStats();
+                        result.bytes = sizeof(*this) + slots.capacity() * sizeof(Slot);
+                        stats(&root, result);
+                        return result;
+                }
+
+                // Totals of every region query since construction or the last reset, always zero unless the traits enable count_queries
+                QueryStats QueryCounters() const
+                {
+                        QueryStats result;
+                        result.nodes_visited = query_counters[0].load(std::memory_order_relaxed);
+                        result.leaves_scanned = query_counters[1].load(std::memory_order_relaxed);
+                        result.points_tested = query_counters[2].load(std::memory_order_relaxed);
+                        result.points_emitted = query_counters[3].load(std::memory_order_relaxed);
+                        return result;
+                }
+
+                void ResetQueryCounters()
+                {
+                        for (size_t k = 0; k < 4; ++k) query_counters[k].store(0, std::memory_order_relaxed);
+                }
+
         };
 
+        // Same as a.Join(b, predicate, callback)
+        template <typename type_a, typename allocator_a, typename traits_a, typename type_b, typename allocator_b, typename traits_b, typename predicate_type, typename callback_type>
+        void Join(const QuadTree<type_a, allocator_a, traits_a>& a, const QuadTree<type_b, allocator_b, traits_b>& b, predicate_type predicate, callback_type callback)
+        {
+                a.Join(b, predicate, callback);
+        }
+
 };
 
 #endif // _QUADTREE_H
@@ -0,0 +1,329 @@
+#include "QuadTreeImage.h"
+
+#include <cstdio>
+#include <cstring>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ORC_NAMESPACE
+{
+
+        static const char image_magic[8] = {'O', 'R', 'C', 'Q', 'T', 'R', 'E', 'E'};
+        static const size_t header_size = 64;
+        static const size_t node_size = 28;
+        static const size_t element_alignment = 64;
+        static const unsigned int max_node_depth = 255; // QuadTreeNode keeps its depth in a byte
+
+        static void put32(unsigned char* out, unsigned int value)
+        {
+                for (size_t k = 0; k < 4; ++k) out[k] = static_cast<unsigned char>(value >> (8 * k));
+        }
+
+        static void put64(unsigned char* out, unsigned long long value)
+        {
+                for (size_t k = 0; k < 8; ++k) out[k] = static_cast<unsigned char>(value >> (8 * k));
+        }
+
+        static unsigned int get32(const unsigned char* in)
+        {
+                unsigned int value = 0;
+                for (size_t k = 0; k < 4; ++k) value |= static_cast<unsigned int>(in[k]) << (8 * k);
+                return value;
+        }
+
+        static unsigned long long get64(const unsigned char* in)
+        {
+                unsigned long long value = 0;
+                for (size_t k = 0; k < 8; ++k) value |= static_cast<unsigned long long>(in[k]) << (8 * k);
+                return value;
+        }
+
+        static void put_float(unsigned char* out, float value)
+        {
+                unsigned int bits;
+                std::memcpy(&bits, &value, sizeof(bits));
+                put32(out, bits);
+        }
+
+        static float get_float(const unsigned char* in)
+        {
+                unsigned int bits = get32(in);
+                float value;
+                std::memcpy(&value, &bits, sizeof(value));
+                return value;
+        }
+
+        static void encode(const FlatNode& node, unsigned char* out)
+        {
+                const vec2 sw = node.region.BottomLeft();
+                const vec2 ne = node.region.TopRight();
+                put_float(out, sw.x);
+                put_float(out + 4, sw.y);
+                put_float(out + 8, ne.x);
+                put_float(out + 12, ne.y);
+                put32(out + 16, node.children);
+                put32(out + 20, node.first);
+                put32(out + 24, node.count);
+        }
+
+        static FlatNode decode(const unsigned char* in)
+        {
+                FlatNode node;
+                node.region = AABB(vec2(get_float(in), get_float(in + 4)), vec2(get_float(in + 8), get_float(in + 12)));
+                node.children = get32(in + 16);
+                node.first = get32(in + 20);
+                node.count = get32(in + 24);
+                return node;
+        }
+
+        // FNV-1a over the bytes, a change of any single byte always changes the result
+        static unsigned long long checksum(unsigned long long hash, const unsigned char* data, size_t size)
+        {
+                for (size_t k = 0; k < size; ++k) hash = (hash ^ data[k]) * 0x100000001B3ull;
+                return hash;
+        }
+
+        static const unsigned long long checksum_seed = 0xCBF29CE484222325ull;
+        static const size_t checksum_offset = 48;
+
+        static unsigned long long align(unsigned long long offset, unsigned long long alignment)
+        {
+                return (offset + alignment - 1) / alignment * alignment;
+        }
+
+        namespace util
+        {
+
+                bool WriteImage(const char* path, const FlatNode* nodes, size_t node_count, const void* elements, size_t element_count, size_t element_size)
+                {
+                        // Counts and indices are 32 bits in the image, just like in the snapshot
+                        const unsigned long long limit = 0xFFFFFFFFull;
+                        if (node_count == 0 || node_count > limit || element_count > limit || element_size > limit) return false;
+
+                        const unsigned long long node_offset = header_size;
+                        const unsigned long long element_offset = align(node_offset + static_cast<unsigned long long>(node_count) * node_size, element_alignment);
+                        const unsigned long long size = element_offset + static_cast<unsigned long long>(element_count) * element_size;
+
+                        unsigned char header[header_size] = {};
+                        std::memcpy(header, image_magic, sizeof(image_magic));
+                        put32(header + 8, image_version);
+                        put32(header + 12, static_cast<unsigned int>(element_size));
+                        put32(header + 16, static_cast<unsigned int>(node_count));
+                        put32(header + 20, static_cast<unsigned int>(element_count));
+                        put64(header + 24, node_offset);
+                        put64(header + 32, element_offset);
+                        put64(header + 40, size);
+
+                        // The checksum covers the whole image, its own field taken as zero
+                        const unsigned char padding[element_alignment] = {};
+                        const size_t gap = static_cast<size_t>(element_offset - node_offset - static_cast<unsigned long long>(node_count) * node_size);
+                        unsigned char record[node_size];
+                        unsigned long long hash = checksum(checksum_seed, header, header_size);
+                        for (size_t k = 0; k < node_count; ++k)
+                        {
+                                encode(nodes[k], record);
+                                hash = checksum(hash, record, node_size);
+                        }
+                        hash = checksum(hash, padding, gap);
+                        hash = checksum(hash, static_cast<const unsigned char*>(elements), element_count * element_size);
+                        put64(header + checksum_offset, hash);
+
+                        FILE* file = std::fopen(path, "wb");
+                        if (file == nullptr) return false;
+
+                        bool written = std::fwrite(header, header_size, 1, file) == 1;
+                        for (size_t k = 0; written && k < node_count; ++k)
+                        {
+                                encode(nodes[k], record);
+                                written = std::fwrite(record, node_size, 1, file) == 1;
+                        }
+
+                        if (written && gap > 0) written = std::fwrite(padding, gap, 1, file) == 1;
+                        if (written && element_count > 0) written = std::fwrite(elements, element_size, element_count, file) == element_count;
+
+                        return std::fclose(file) == 0 && written;
+                }
+
+                bool ReadImage(const unsigned char* data, size_t size, size_t element_size, ImageHeader& header, bool verify)
+                {
+                        if (data == nullptr || size < header_size || std::memcmp(data, image_magic, sizeof(image_magic)) != 0) return false;
+
+                        header.version = get32(data + 8);
+                        header.element_size = get32(data + 12);
+                        header.node_count = get32(data + 16);
+                        header.element_count = get32(data + 20);
+                        header.node_offset = get64(data + 24);
+                        header.element_offset = get64(data + 32);
+                        header.size = get64(data + 40);
+                        header.checksum = get64(data + checksum_offset);
+
+                        // The offsets are bounded before anything is added to them, so none of the sums below can overflow
+                        if (header.version != image_version || header.element_size != element_size || header.node_count == 0) return false;
+                        if (header.size > size || header.node_offset > header.size || header.element_offset > header.size) return false;
+                        if (header.node_offset < header_size || header.node_offset % 4 != 0 || header.element_offset % element_alignment != 0) return false;
+                        if (header.node_offset + static_cast<unsigned long long>(header.node_count) * node_size > header.element_offset) return false;
+                        if (header.element_offset + static_cast<unsigned long long>(header.element_count) * element_size > header.size) return false;
+
+                        // Corruption is caught here, the checks below keep an image that wasn't verified or still sums up right from being walked out of bounds
+                        if (verify)
+                        {
+                                unsigned char first[header_size];
+                                std::memcpy(first, data, header_size);
+                                put64(first + checksum_offset, 0);
+                                const unsigned long long hash = checksum(checksum_seed, first, header_size);
+                                if (checksum(hash, data + header_size, static_cast<size_t>(header.size) - header_size) != header.checksum) return false;
+                        }
+
+                        // Nodes are checked in index order, children always come after their parent and are reached exactly once
+                        std::vector<unsigned short> depth(header.node_count, 0); // 0 until the node is reached, then its depth plus one
+                        depth[0] = 1;
+                        for (unsigned int index = 0; index < header.node_count; ++index)
+                        {
+                                if (depth[index] == 0) return false;
+
+                                const FlatNode node = ImageNode(data, header, index);
+                                if (static_cast<unsigned long long>(node.first) + node.count > header.element_count) return false;
+                                if (index == 0 && (node.first != 0 || node.count != header.element_count)) return false;
+                                if (node.children == 0) continue; // leaf node
+
+                                if (node.children <= index || static_cast<unsigned long long>(node.children) + 4 > header.node_count) return false;
+                                if (depth[index] > max_node_depth) return false;
+
+                                unsigned long long next = node.first;
+                                for (unsigned int k = 0; k < 4; ++k)
+                                {
+                                        const unsigned int child = node.children + k;
+                                        const FlatNode entry = ImageNode(data, header, child);
+                                        if (depth[child] != 0 || entry.first != next || !node.region.Contains(entry.region)) return false;
+                                        depth[child] = static_cast<unsigned short>(depth[index] + 1);
+                                        next += entry.count;
+                                }
+                                if (next != static_cast<unsigned long long>(node.first) + node.count) return false;
+                        }
+                        return true;
+                }
+
+                FlatNode ImageNode(const unsigned char* data, const ImageHeader& header, unsigned int index)
+                {
+                        return decode(data + header.node_offset + static_cast<size_t>(index) * node_size);
+                }
+
+                bool NativeImageLayout()
+                {
+                        if (sizeof(FlatNode) != node_size) return false;
+
+                        FlatNode node;
+                        node.region = AABB(vec2(1.0f, 2.0f), vec2(3.0f, 4.0f));
+                        node.children = 5;
+                        node.first = 6;
+                        node.count = 7;
+
+                        unsigned char record[node_size];
+                        encode(node, record);
+                        return std::memcmp(record, &node, node_size) == 0;
+                }
+
+        }
+
+        //////////////////////////////////////////////////////////////////////////
+
+#if defined(_WIN32)
+
+        MappedFile::MappedFile() : data(nullptr), size(0), file(INVALID_HANDLE_VALUE), mapping(nullptr)
+        {}
+
+        bool MappedFile::Open(const char* path)
+        {
+                Close();
+                file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+                if (file == INVALID_HANDLE_VALUE) return false;
+
+                LARGE_INTEGER length;
+                if (!GetFileSizeEx(file, &length) || length.QuadPart == 0 || static_cast<unsigned long long>(length.QuadPart) > static_cast<size_t>(-1))
+                {
+                        Close();
+                        return false;
+                }
+
+                mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                const void* view = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+                if (view == nullptr)
+                {
+                        Close();
+                        return false;
+                }
+
+                data = static_cast<const unsigned char*>(view);
+                size = static_cast<size_t>(length.QuadPart);
+                return true;
+        }
+
+        void MappedFile::Close()
+        {
+                if (data != nullptr) UnmapViewOfFile(data);
+                if (mapping != nullptr) CloseHandle(mapping);
+                if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+                data = nullptr;
+                size = 0;
+                mapping = nullptr;
+                file = INVALID_HANDLE_VALUE;
+        }
+
+#else
+
+        MappedFile::MappedFile() : data(nullptr), size(0)
+        {}
+
+        bool MappedFile::Open(const char* path)
+        {
+                Close();
+                int file = open(path, O_RDONLY);
+                if (file < 0) return false;
+
+                // The mapping stays valid once the descriptor is closed
+                struct stat status;
+                void* view = MAP_FAILED;
+                if (fstat(file, &status) == 0 && status.st_size > 0)
+                        view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+                close(file);
+                if (view == MAP_FAILED) return false;
+
+                data = static_cast<const unsigned char*>(view);
+                size = static_cast<size_t>(status.st_size);
+                return true;
+        }
+
+        void MappedFile::Close()
+        {
+                if (data != nullptr) munmap(const_cast<unsigned char*>(data), size);
+                data = nullptr;
+                size = 0;
+        }
+
+#endif
+
+        MappedFile::~MappedFile()
+        {
+                Close();
+        }
+
+        const unsigned char* MappedFile::Data() const
+        {
+                return data;
+        }
+
+        size_t MappedFile::Size() const
+        {
+                return size;
+        }
+
+};
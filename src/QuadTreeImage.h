@@ -0,0 +1,177 @@
+#ifndef _QUADTREE_IMAGE_H
+#define _QUADTREE_IMAGE_H
+
+#include "config.h"
+#include "AABB.h"
+#include "QuadTreeSnapshot.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+namespace ORC_NAMESPACE
+{
+
+        /*
+        Binary image of a QuadTree, written by QuadTree::Save and read back by QuadTree::Load or in place by QuadTreeView.
+        It's the flat layout of QuadTreeSnapshot, nodes reference their children and elements by index so the image works at any address.
+        Layout, integers and floats are little endian:
+                header, 64 bytes: "ORCQTREE", version, element size, node count, element count as 32 bits, node offset, element offset, total size, checksum as 64 bits
+                nodes at the node offset, 28 bytes each: region as sw.x, sw.y, ne.x, ne.y, then children, first and count
+                elements at the element offset, which is 64 byte aligned: the bytes of each type_p as they are in memory
+                the checksum is the 64 bit FNV-1a of the total size bytes of the image, its own 8 bytes taken as zero
+        REMARK: Elements aren't converted, an image can only be read on machines agreeing on the layout of type_p
+        */
+        namespace util
+        {
+                static const unsigned int image_version = 2;
+
+                struct ImageHeader
+                {
+                        unsigned int version;
+                        unsigned int element_size;
+                        unsigned int node_count;
+                        unsigned int element_count;
+                        unsigned long long node_offset;
+                        unsigned long long element_offset;
+                        unsigned long long size;
+                        unsigned long long checksum;
+                };
+
+                // Writes the flat layout to the file, returns false if it couldn't be written completely
+                bool WriteImage(const char* path, const FlatNode* nodes, size_t node_count, const void* elements, size_t element_count, size_t element_size);
+
+                /*
+                Description: decodes the header and checks every node of the image, returns false if it's malformed or holds elements of another size
+                Remark: an image passing the check is a well formed tree, every node range lies inside the image, every subtree's elements are contiguous and every child lies inside its parent
+                Remark: verify also checks the checksum, which reads the whole image, elements included, so corrupted element bytes are caught too
+                */
+                bool ReadImage(const unsigned char* data, size_t size, size_t element_size, ImageHeader& header, bool verify);
+
+                // Decodes the node at index of an image that passed ReadImage
+                FlatNode ImageNode(const unsigned char* data, const ImageHeader& header, unsigned int index);
+
+                // True if the nodes of an image are laid out like FlatNode in memory, so they can be read in place
+                bool NativeImageLayout();
+        }
+
+        /*
+        Read only memory mapping of a whole file
+        */
+        class MappedFile final
+        {
+                const unsigned char* data;
+                size_t size;
+#if defined(_WIN32)
+                void* file;
+                void* mapping;
+#endif
+
+        public:
+
+                MappedFile();
+                ~MappedFile();
+
+                MappedFile(const MappedFile&) = delete;
+                MappedFile& operator=(const MappedFile&) = delete;
+
+                // Closes the current mapping, if any, returns false if the file couldn't be mapped
+                bool Open(const char* path);
+                void Close();
+
+                const unsigned char* Data() const;
+                size_t Size() const;
+        };
+
+        /*
+        Read only view of a QuadTree image answering region queries in place, nothing is copied or deserialized.
+        REMARK: The image is validated once when the view is opened, after that nothing is ever written and any number of threads may query it concurrently
+        REMARK: Region is only meaningful once the view has been opened
+        */
+        template <typename type_p>
+        class QuadTreeView
+        {
+                static_assert(std::is_trivially_copyable<type_p>::value, "QuadTree images hold the bytes of their elements, type_p must be trivially copyable");
+
+                MappedFile file;
+                const FlatNode* nodes;
+                const type_p* elements;
+                size_t element_count;
+
+                bool attach(const unsigned char* data, size_t size, bool verify)
+                {
+                        util::ImageHeader header;
+                        if (!util::NativeImageLayout() || !util::ReadImage(data, size, sizeof(type_p), header, verify)) return false;
+
+                        // Images are written 64 byte aligned, buffers provided by the caller may not be
+                        const unsigned char* first = data + header.element_offset;
+                        if (reinterpret_cast<std::uintptr_t>(data + header.node_offset) % std::alignment_of<FlatNode>::value != 0) return false;
+                        if (reinterpret_cast<std::uintptr_t>(first) % std::alignment_of<type_p>::value != 0) return false;
+
+                        nodes = reinterpret_cast<const FlatNode*>(data + header.node_offset);
+                        elements = reinterpret_cast<const type_p*>(first);
+                        element_count = header.element_count;
+                        return true;
+                }
+
+        public:
+
+                QuadTreeView() : nodes(nullptr), elements(nullptr), element_count(0)
+                {}
+
+                /*
+                Description: maps the image written by QuadTree::Save, returns false if it can't be mapped or isn't a valid image for type_p
+                Remark: the header and the nodes are always checked, verify also checks the checksum, which reads every page of the file rather than only the ones queries touch
+                */
+                bool Open(const char* path, bool verify = false)
+                {
+                        Close();
+                        if (file.Open(path) && attach(file.Data(), file.Size(), verify)) return true;
+                        Close();
+                        return false;
+                }
+
+                // Same as Open, over an image the caller keeps alive for as long as the view is used
+                bool Open(const void* data, size_t size, bool verify = false)
+                {
+                        Close();
+                        return attach(static_cast<const unsigned char*>(data), size, verify);
+                }
+
+                void Close()
+                {
+                        file.Close();
+                        nodes = nullptr;
+                        elements = nullptr;
+                        element_count = 0;
+                }
+
+                template <typename callback_type>
+                void ForEachInRegion(const AABB& region, callback_type callback) const
+                {
+                        if (nodes != nullptr && nodes[0].region.Intersect(region))
+                                util::FlatForEach(nodes, elements, region, 0, callback);
+                }
+
+                std::vector<const type_p*> Query(const AABB& region) const
+                {
+                        std::vector<const type_p*> results;
+                        ForEachInRegion(region, [&results](const type_p& item) { results.emplace_back(&item); });
+                        return results;
+                }
+
+                const AABB& Region() const
+                {
+                        return nodes[0].region;
+                }
+
+                size_t Size() const
+                {
+                        return element_count;
+                }
+        };
+
+};
+
+#endif // _QUADTREE_IMAGE_H
@@ -0,0 +1,196 @@
+#ifndef _QUADTREE_SNAPSHOT_H
+#define _QUADTREE_SNAPSHOT_H
+
+#include "config.h"
+#include "AABB.h"
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace ORC_NAMESPACE
+{
+
+        template <typename type_p, typename allocator_type, typename traits_type>
+        class QuadTree;
+
+        /*
+        Node of the flat layout shared by QuadTreeSnapshot and the images read by QuadTreeView
+        */
+        struct FlatNode
+        {
+                AABB region;
+                unsigned int children; // index of the first of four consecutive children, 0 for leaves
+                unsigned int first; // the subtree's elements are [first, first + count)
+                unsigned int count;
+        };
+
+        namespace util
+        {
+                static const size_t flat_stack_size = 3 * 16 + 1;
+
+                // Region query over the flat layout starting at the node at index, nodes entirely inside the region emit their contiguous range
+                template <typename type_p, typename callback_type>
+                void FlatForEach(const FlatNode* nodes, const type_p* elements, const AABB& region, unsigned int index, callback_type& callback)
+                {
+                        unsigned int stack[flat_stack_size];
+                        size_t top = 0;
+                        stack[top++] = index;
+
+                        while (top > 0)
+                        {
+                                const FlatNode& node = nodes[stack[--top]];
+                                if (region.Contains(node.region)) // whole node accepted, its elements are contiguous
+                                {
+                                        for (unsigned int k = node.first; k < node.first + node.count; ++k) callback(elements[k]);
+                                }
+                                else if (node.children != 0) // internal node, descend
+                                {
+                                        for (unsigned int k = 0; k < 4; ++k)
+                                        {
+                                                const FlatNode& child = nodes[node.children + k];
+                                                if (child.count == 0 || !child.region.Intersect(region)) continue;
+                                                if (top < flat_stack_size) stack[top++] = node.children + k;
+                                                else FlatForEach(nodes, elements, region, node.children + k, callback);
+                                        }
+                                }
+                                else // leaf node
+                                {
+                                        for (unsigned int k = node.first; k < node.first + node.count; ++k)
+                                        {
+                                                if (region.Inside(elements[k].Position())) callback(elements[k]);
+                                        }
+                                }
+                        }
+                }
+        }
+
+        /*
+        Immutable copy of a QuadTree laid out in two flat arrays, nodes reference each other and their elements by index.
+        Elements are stored in depth first order, so the elements of any subtree form one contiguous range.
+        REMARK: Nothing in here is ever modified after the snapshot is taken, any number of threads may query it concurrently
+        */
+        template <typename type_p>
+        class QuadTreeSharedSnapshot;
+
+        template <typename type_p>
+        class QuadTreeSnapshot
+        {
+                template <typename, typename, typename> friend class QuadTree;
+                friend class QuadTreeSharedSnapshot<type_p>;
+
+        public:
+
+                typedef FlatNode Node;
+
+        protected:
+
+                std::vector<Node> nodes;
+                std::vector<type_p> elements;
+
+        public:
+
+                template <typename callback_type>
+                void ForEachInRegion(const AABB& region, callback_type callback) const
+                {
+                        if (!nodes.empty() && nodes[0].region.Intersect(region))
+                                util::FlatForEach(nodes.data(), elements.data(), region, 0, callback);
+                }
+
+                std::vector<const type_p*> Query(const AABB& region) const
+                {
+                        std::vector<const type_p*> results;
+                        ForEachInRegion(region, [&results](const type_p& item) { results.emplace_back(&item); });
+                        return results;
+                }
+
+                const AABB& Region() const
+                {
+                        return nodes[0].region;
+                }
+
+                size_t Size() const
+                {
+                        return elements.size();
+                }
+        };
+
+        /*
+        Snapshot published by QuadTree::Publish. The nodes near the root are copied by every Publish, the subtrees holding few enough elements are
+        QuadTreeSnapshot pieces shared by successive publishes until something changes in them, so a publish costs as much as what changed since the last one.
+        REMARK: Nothing in here is modified while a reader holds it, any number of threads may query it concurrently
+        */
+        template <typename type_p>
+        class QuadTreeSharedSnapshot
+        {
+                template <typename, typename, typename> friend class QuadTree;
+
+        public:
+
+                typedef QuadTreeSnapshot<type_p> Piece;
+
+        protected:
+
+                std::vector<FlatNode> nodes; // the roots of pieces have no children, their first is the index of the piece
+                std::vector<std::shared_ptr<const Piece>> pieces;
+
+                template <typename callback_type>
+                void for_each(const AABB& region, unsigned int index, callback_type& callback) const
+                {
+                        const FlatNode& node = nodes[index];
+                        if (node.children == 0)
+                        {
+                                pieces[node.first]->ForEachInRegion(region, std::ref(callback));
+                                return;
+                        }
+
+                        for (unsigned int k = 0; k < 4; ++k)
+                        {
+                                const FlatNode& child = nodes[node.children + k];
+                                if (child.count != 0 && child.region.Intersect(region)) for_each(region, node.children + k, callback);
+                        }
+                }
+
+        public:
+
+                template <typename callback_type>
+                void ForEachInRegion(const AABB& region, callback_type callback) const
+                {
+                        if (!nodes.empty() && nodes[0].region.Intersect(region)) for_each(region, 0, callback);
+                }
+
+                std::vector<const type_p*> Query(const AABB& region) const
+                {
+                        std::vector<const type_p*> results;
+                        ForEachInRegion(region, [&results](const type_p& item) { results.emplace_back(&item); });
+                        return results;
+                }
+
+                // Invokes callback(const AABB&) with the region of every leaf, meant for diagnostics and rendering
+                template <typename callback_type>
+                void ForEachLeaf(callback_type callback) const
+                {
+                        for (size_t k = 0; k < pieces.size(); ++k)
+                        {
+                                for (const FlatNode& node : pieces[k]->nodes)
+                                {
+                                        if (node.children == 0) callback(node.region);
+                                }
+                        }
+                }
+
+                const AABB& Region() const
+                {
+                        return nodes[0].region;
+                }
+
+                size_t Size() const
+                {
+                        return nodes[0].count;
+                }
+        };
+
+};
+
+#endif // _QUADTREE_SNAPSHOT_H
@@ -0,0 +1,140 @@
+#include "Shapes.h"
+
+#include <cmath>
+
+namespace ORC_NAMESPACE
+{
+
+        static float dot(const vec2& a, const vec2& b)
+        {
+                return a.x * b.x + a.y * b.y;
+        }
+
+        static float cross(const vec2& a, const vec2& b)
+        {
+                return a.x * b.y - a.y * b.x;
+        }
+
+        // Corners of a box, counter clockwise from the bottom left one
+        static void corners(const AABB& box, vec2* out)
+        {
+                out[0] = box.BottomLeft();
+                out[1] = box.BottomRight();
+                out[2] = box.TopRight();
+                out[3] = box.TopLeft();
+        }
+
+        Circle::Circle(const vec2& center, float radius) : center(center), radius_squared(radius * radius)
+        {}
+
+        Overlap Circle::Classify(const AABB& box) const
+        {
+                if (box.DistanceSquared(center) > radius_squared) return OUTSIDE;
+
+                // Inside if the farthest corner is
+                vec2 sw = box.BottomLeft(), ne = box.TopRight();
+                float dx = std::fmax(center.x - sw.x, ne.x - center.x);
+                float dy = std::fmax(center.y - sw.y, ne.y - center.y);
+                return dx * dx + dy * dy <= radius_squared ? INSIDE : PARTIAL;
+        }
+
+        bool Circle::Inside(const vec2& point) const
+        {
+                vec2 d = point - center;
+                return dot(d, d) <= radius_squared;
+        }
+
+        ConvexPolygon::ConvexPolygon(const vec2* points, size_t count) : vertices(points, points + count)
+        {
+                // Signed area tells the winding, clockwise polygons are reversed
+                float area = 0.0f;
+                for (size_t k = 0; k < count; ++k) area += cross(vertices[k], vertices[(k + 1) % count]);
+                if (area < 0.0f) std::vector<vec2>(vertices.rbegin(), vertices.rend()).swap(vertices);
+
+                vec2 sw = count > 0 ? vertices[0] : vec2(0.0f, 0.0f);
+                vec2 ne = sw;
+                for (size_t k = 0; k < count; ++k)
+                {
+                        const vec2& a = vertices[k];
+                        const vec2& b = vertices[(k + 1) % count];
+                        vec2 normal(b.y - a.y, a.x - b.x);
+                        normals.push_back(normal);
+                        offsets.push_back(dot(normal, a));
+
+                        sw.x = std::fmin(sw.x, a.x); sw.y = std::fmin(sw.y, a.y);
+                        ne.x = std::fmax(ne.x, a.x); ne.y = std::fmax(ne.y, a.y);
+                }
+                bounds = AABB(sw, ne);
+        }
+
+        Overlap ConvexPolygon::Classify(const AABB& box) const
+        {
+                // The box's own axes separate them if the bounding boxes don't intersect
+                if (vertices.size() < 3 || !bounds.Intersect(box)) return OUTSIDE;
+
+                vec2 points[4];
+                corners(box, points);
+
+                bool inside = true;
+                for (size_t k = 0; k < normals.size(); ++k)
+                {
+                        unsigned int outside = 0;
+                        for (size_t c = 0; c < 4; ++c) outside += dot(normals[k], points[c]) > offsets[k];
+                        if (outside == 4) return OUTSIDE; // the edge separates them
+                        if (outside != 0) inside = false;
+                }
+                return inside ? INSIDE : PARTIAL;
+        }
+
+        bool ConvexPolygon::Inside(const vec2& point) const
+        {
+                if (vertices.size() < 3) return false;
+                for (size_t k = 0; k < normals.size(); ++k)
+                {
+                        if (dot(normals[k], point) > offsets[k]) return false;
+                }
+                return true;
+        }
+
+        OrientedBox::OrientedBox(const vec2& center, const vec2& half_extents, float angle) :
+                center(center), axis_x(std::cos(angle), std::sin(angle)), axis_y(-std::sin(angle), std::cos(angle)), half_extents(half_extents)
+        {}
+
+        Overlap OrientedBox::Classify(const AABB& box) const
+        {
+                vec2 points[4];
+                corners(box, points);
+
+                // Separating axis test, first along the oriented box's axes, a corner outside on any side means it's not entirely inside
+                bool inside = true;
+                const vec2* axes[2] = {&axis_x, &axis_y};
+                const float extents[2] = {half_extents.x, half_extents.y};
+                for (size_t k = 0; k < 2; ++k)
+                {
+                        float low = dot(*axes[k], points[0] - center), high = low;
+                        for (size_t c = 1; c < 4; ++c)
+                        {
+                                float projection = dot(*axes[k], points[c] - center);
+                                low = std::fmin(low, projection);
+                                high = std::fmax(high, projection);
+                        }
+                        if (low > extents[k] || high < -extents[k]) return OUTSIDE;
+                        if (low < -extents[k] || high > extents[k]) inside = false;
+                }
+
+                // Then along the box's axes, where the oriented box projects to its own bounding interval
+                float reach_x = half_extents.x * std::fabs(axis_x.x) + half_extents.y * std::fabs(axis_y.x);
+                float reach_y = half_extents.x * std::fabs(axis_x.y) + half_extents.y * std::fabs(axis_y.y);
+                AABB reach(center - vec2(reach_x, reach_y), center + vec2(reach_x, reach_y));
+                if (!reach.Intersect(box)) return OUTSIDE;
+
+                return inside ? INSIDE : PARTIAL;
+        }
+
+        bool OrientedBox::Inside(const vec2& point) const
+        {
+                vec2 d = point - center;
+                return std::fabs(dot(d, axis_x)) <= half_extents.x && std::fabs(dot(d, axis_y)) <= half_extents.y;
+        }
+
+};
@@ -0,0 +1,74 @@
+#ifndef _SHAPES_H
+#define _SHAPES_H
+
+#include "config.h"
+#include "AABB.h"
+
+#include <cstddef>
+#include <vector>
+
+namespace ORC_NAMESPACE
+{
+
+        // How a box relates to a query shape
+        enum Overlap
+        {
+                OUTSIDE, PARTIAL, INSIDE
+        };
+
+        /*
+        Query shapes, anything providing Classify(const AABB&) and Inside(const vec2&) can be passed to QuadTree::QueryShape
+        Classify may answer PARTIAL for a box that's actually outside, that only costs some extra point tests, but INSIDE and OUTSIDE must be exact
+        */
+
+        class Circle final
+        {
+                vec2 center;
+                float radius_squared;
+
+        public:
+
+                Circle(const vec2& center, float radius);
+
+                Overlap Classify(const AABB& box) const;
+                bool Inside(const vec2& point) const;
+        };
+
+        /*
+        Convex polygon, the vertices may be given in either winding order
+        REMARK: Classify only separates along the polygon's edges and the box's axes, which is exact for convex shapes
+        */
+        class ConvexPolygon final
+        {
+                std::vector<vec2> vertices; // counter clockwise
+                std::vector<vec2> normals; // outward, one per edge starting at the vertex with the same index
+                std::vector<float> offsets; // a point is inside an edge if dot(normal, point) <= offset
+                AABB bounds;
+
+        public:
+
+                ConvexPolygon(const vec2* points, size_t count);
+
+                Overlap Classify(const AABB& box) const;
+                bool Inside(const vec2& point) const;
+        };
+
+        // Box rotated by angle radians counter clockwise around its center
+        class OrientedBox final
+        {
+                vec2 center;
+                vec2 axis_x; // unit axes of the box
+                vec2 axis_y;
+                vec2 half_extents;
+
+        public:
+
+                OrientedBox(const vec2& center, const vec2& half_extents, float angle);
+
+                Overlap Classify(const AABB& box) const;
+                bool Inside(const vec2& point) const;
+        };
+
+};
+
+#endif // _SHAPES_H
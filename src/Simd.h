@@ -0,0 +1,97 @@
+#ifndef _SIMD_H
+#define _SIMD_H
+
+#include "config.h"
+#include "AABB.h"
+
+#include <cstddef>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define ORC_SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ORC_SIMD_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace ORC_NAMESPACE
+{
+
+        namespace util
+        {
+                // Index of the lowest set bit, mask must not be zero
+                inline unsigned int LowestBit(unsigned int mask)
+                {
+#ifdef _MSC_VER
+                        unsigned long index;
+                        _BitScanForward(&index, mask);
+                        return index;
+#else
+                        return __builtin_ctz(mask);
+#endif
+                }
+
+                /*
+                Description: calls callback(index) for every point of the coordinate arrays that lies inside the region, in increasing index order
+                Remark: 8 (AVX) or 4 (SSE2) points are tested per iteration, the comparison results are packed into a bitmask and only set bits are visited
+                Remark: the bounds are inclusive, exactly like AABB::Inside
+                */
+                template <typename callback_type>
+                void ScanInside(const float* xs, const float* ys, size_t count, const AABB& region, callback_type& callback)
+                {
+                        const vec2 sw = region.BottomLeft();
+                        const vec2 ne = region.TopRight();
+                        size_t k = 0;
+
+#if defined(ORC_SIMD_AVX)
+                        const __m256 min_x = _mm256_set1_ps(sw.x), max_x = _mm256_set1_ps(ne.x);
+                        const __m256 min_y = _mm256_set1_ps(sw.y), max_y = _mm256_set1_ps(ne.y);
+                        for (; k + 8 <= count; k += 8)
+                        {
+                                __m256 x = _mm256_loadu_ps(xs + k);
+                                __m256 y = _mm256_loadu_ps(ys + k);
+                                __m256 inside = _mm256_and_ps(
+                                        _mm256_and_ps(_mm256_cmp_ps(x, min_x, _CMP_GE_OQ), _mm256_cmp_ps(x, max_x, _CMP_LE_OQ)),
+                                        _mm256_and_ps(_mm256_cmp_ps(y, min_y, _CMP_GE_OQ), _mm256_cmp_ps(y, max_y, _CMP_LE_OQ)));
+                                unsigned int mask = static_cast<unsigned int>(_mm256_movemask_ps(inside));
+                                while (mask != 0)
+                                {
+                                        callback(k + LowestBit(mask));
+                                        mask &= mask - 1;
+                                }
+                        }
+#elif defined(ORC_SIMD_SSE2)
+                        const __m128 min_x = _mm_set1_ps(sw.x), max_x = _mm_set1_ps(ne.x);
+                        const __m128 min_y = _mm_set1_ps(sw.y), max_y = _mm_set1_ps(ne.y);
+                        for (; k + 4 <= count; k += 4)
+                        {
+                                __m128 x = _mm_loadu_ps(xs + k);
+                                __m128 y = _mm_loadu_ps(ys + k);
+                                __m128 inside = _mm_and_ps(
+                                        _mm_and_ps(_mm_cmpge_ps(x, min_x), _mm_cmple_ps(x, max_x)),
+                                        _mm_and_ps(_mm_cmpge_ps(y, min_y), _mm_cmple_ps(y, max_y)));
+                                unsigned int mask = static_cast<unsigned int>(_mm_movemask_ps(inside));
+                                while (mask != 0)
+                                {
+                                        callback(k + LowestBit(mask));
+                                        mask &= mask - 1;
+                                }
+                        }
+#endif
+
+                        // Remaining points, or every point without SIMD support
+                        for (; k < count; ++k)
+                        {
+                                if (xs[k] >= sw.x && xs[k] <= ne.x && ys[k] >= sw.y && ys[k] <= ne.y)
+                                        callback(k);
+                        }
+                }
+        }
+
+};
+
+#endif // _SIMD_H
@@ -2,8 +2,14 @@
 #define _SMART_POOL_ALLOCATOR_H
 
 #include "config.h"
+#include <atomic>
+#include <cstdlib>
 #include <memory>
-#include <iostream>
+#include <new>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 namespace ORC_NAMESPACE
 {
@@ -22,45 +28,369 @@ namespace ORC_NAMESPACE
                 return static_cast<char*>(address) +offset;
         }
 
+        /*
+        Every block starts with a tag holding its size and two flags, a free block also repeats its size in its last word (the boundary tag).
+        That way both neighbours of a freed block can be found without searching, so adjacent free blocks are merged on the spot.
+        */
         struct Bookkeeper
         {
-                size_t size;
-                Bookkeeper* next;
+                size_t tag;
+                Bookkeeper* next; // only valid while the block is free
+                Bookkeeper* prev;
+        };
+
+        static const size_t tag_free = 1; // the block is in a free list
+        static const size_t tag_prev_free = 2; // the block right before it is in a free list
+        static const size_t tag_flags = tag_free | tag_prev_free;
+
+        // Every block size is a multiple of the granule, large enough to leave the flag bits of the tag unused
+        static const size_t pool_granule = 2 * sizeof(void*);
+        // Smallest block that can be bookkept once freed: header, links and boundary tag
+        static const size_t pool_min_block = (sizeof(Bookkeeper) + sizeof(size_t) + pool_granule - 1) / pool_granule * pool_granule;
+        // Blocks smaller than 2^exact_bits granules get a size class each, larger ones share one class per power of two
+        static const unsigned int exact_bits = 5;
+        static const unsigned int size_classes = 64;
+
+        // Search lengths are bucketed by powers of two: 0, 1, 2-3, 4-7, 8-15, 16-31, 32 or more classes skipped
+        static const unsigned int search_buckets = 7;
+
+        /*
+        Counters kept by every pool, each one has a single writer (the thread owning the pool) so they're updated with plain relaxed loads and stores.
+        Any thread may read them at any time, the values are individually exact but not a consistent snapshot of each other.
+        */
+        struct PoolCounters
+        {
+                std::atomic<size_t> bytes_in_use; // including block headers and rounding
+                std::atomic<size_t> high_water;
+                std::atomic<size_t> bump_hits;
+                std::atomic<size_t> free_list_hits;
+                std::atomic<size_t> chunk_hits; // allocations that had to chain another chunk
+                std::atomic<size_t> free_blocks;
+                std::atomic<size_t> search_lengths[search_buckets]; // size classes skipped by free list hits
         };
+
+        // Values read from PoolCounters, see there
+        struct PoolStats
+        {
+                size_t bytes_in_use;
+                size_t high_water;
+                size_t bump_hits;
+                size_t free_list_hits;
+                size_t chunk_hits;
+                size_t free_blocks;
+                size_t search_lengths[search_buckets];
+        };
+
+        // Single writer update, no read-modify-write instruction needed
+        inline static void count(std::atomic<size_t>& counter, size_t delta)
+        {
+                counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+        }
+
+        // Additional memory chained to a pool once it fills up
+        struct PoolChunk
+        {
+                PoolChunk* next;
+        };
+
         struct MemoryPool
         {
-                void* end;
+                void* end; // end of the chunk currently bump allocated from, the last word is reserved for a sentinel tag
                 void* current;
-                Bookkeeper* bk_first;
+                size_t chunk_size; // minimum size of the next chained chunk
+                PoolChunk* chunks;
+                Bookkeeper* free_lists[size_classes]; // freed blocks of every chunk, segregated by size class
+                unsigned int free_masks[size_classes / 32]; // a bit is set for every non empty list
+                PoolCounters counters;
         };
 
+        inline static unsigned int lowest_bit(unsigned int mask)
+        {
+#ifdef _MSC_VER
+                unsigned long index;
+                _BitScanForward(&index, mask);
+                return index;
+#else
+                return __builtin_ctz(mask);
+#endif
+        }
+
+        inline static unsigned int highest_bit(unsigned int mask)
+        {
+#ifdef _MSC_VER
+                unsigned long index;
+                _BitScanReverse(&index, mask);
+                return index;
+#else
+                return 31 - __builtin_clz(mask);
+#endif
+        }
+
+        // Size of the block holding a request, including its tag, rounded up to whole granules
+        inline static size_t block_size(size_t bytes)
+        {
+                bytes += sizeof(size_t);
+                return bytes > pool_min_block ? (bytes + pool_granule - 1) / pool_granule * pool_granule : pool_min_block;
+        }
+
+        inline static size_t& tag_of(void* block)
+        {
+                return *static_cast<size_t*>(block);
+        }
+
+        inline static unsigned int size_class(size_t bytes)
+        {
+                size_t granules = bytes / pool_granule;
+                if (granules < (size_t(1) << exact_bits)) return static_cast<unsigned int>(granules);
+                if (granules > 0xFFFFFFFF) return size_classes - 1;
+                return (1U << exact_bits) + highest_bit(static_cast<unsigned int>(granules)) - exact_bits;
+        }
+
+        inline static void pool_link(MemoryPool* pool, Bookkeeper* node, size_t bytes)
+        {
+                unsigned int index = size_class(bytes);
+                node->tag = bytes | tag_free;
+                tag_of(ptr_add(node, bytes - sizeof(size_t))) = bytes;
+                node->prev = nullptr;
+                node->next = pool->free_lists[index];
+                if (node->next != nullptr) node->next->prev = node;
+                pool->free_lists[index] = node;
+                pool->free_masks[index / 32] |= 1U << (index % 32);
+                count(pool->counters.free_blocks, 1);
+        }
+
+        inline static void pool_unlink(MemoryPool* pool, Bookkeeper* node)
+        {
+                unsigned int index = size_class(node->tag & ~tag_flags);
+                if (node->next != nullptr) node->next->prev = node->prev;
+                if (node->prev != nullptr) node->prev->next = node->next;
+                else
+                {
+                        pool->free_lists[index] = node->next;
+                        if (node->next == nullptr) pool->free_masks[index / 32] &= ~(1U << (index % 32));
+                }
+                count(pool->counters.free_blocks, size_t(0) - 1);
+        }
+
         /*
-        Description: creates a block of memory that can be used by allocators
-        Remark: std::free must be called on it after using it, otherwise the memory will leak
+        Description: returns a block to the pool, merging it with its free neighbours
+        Remark: a block ending where bump allocation continues is given back to the bump region instead, so the block before the bump pointer is never free
         */
-        MemoryPool* MakeMemoryPool(size_t size)
+        inline static void pool_store(MemoryPool* pool, void* block)
+        {
+                size_t tag = tag_of(block);
+                size_t bytes = tag & ~tag_flags;
+
+                if (tag & tag_prev_free)
+                {
+                        size_t prev_bytes = tag_of(static_cast<char*>(block) - sizeof(size_t));
+                        block = static_cast<char*>(block) - prev_bytes;
+                        pool_unlink(pool, static_cast<Bookkeeper*>(block));
+                        bytes += prev_bytes;
+                }
+
+                void* next = ptr_add(block, bytes);
+                if (next == pool->current)
+                {
+                        pool->current = block;
+                        return;
+                }
+
+                size_t next_tag = tag_of(next);
+                if (next_tag & tag_free)
+                {
+                        pool_unlink(pool, static_cast<Bookkeeper*>(next));
+                        bytes += next_tag & ~tag_flags;
+                }
+                else tag_of(next) = next_tag | tag_prev_free;
+
+                pool_link(pool, static_cast<Bookkeeper*>(block), bytes);
+        }
+
+        /*
+        Description: takes a freed block of at least the given size, splitting it if it's larger, nullptr if there's none
+        Remark: the head of an exact class always fits, otherwise the first non empty class above it is used, so no list is ever walked
+        */
+        inline static void* pool_take(MemoryPool* pool, size_t bytes)
+        {
+                unsigned int index = size_class(bytes);
+                unsigned int skipped = 0;
+                Bookkeeper* node = pool->free_lists[index];
+
+                if (node == nullptr || (node->tag & ~tag_flags) < bytes)
+                {
+                        node = nullptr;
+                        for (unsigned int start = index + 1, word = start / 32; word < size_classes / 32; ++word)
+                        {
+                                unsigned int mask = pool->free_masks[word];
+                                if (word == start / 32) mask &= ~0U << (start % 32);
+                                if (mask == 0) continue;
+
+                                skipped = word * 32 + lowest_bit(mask) - index;
+                                node = pool->free_lists[index + skipped];
+                                break;
+                        }
+                        if (node == nullptr) return nullptr;
+                }
+
+                unsigned int bucket = skipped == 0 ? 0 : highest_bit(skipped) + 1;
+                count(pool->counters.search_lengths[bucket < search_buckets ? bucket : search_buckets - 1], 1);
+
+                pool_unlink(pool, node);
+                size_t available = node->tag & ~tag_flags;
+
+                // Oversized block, the tail goes back to the list of its own class and keeps the next block's flag set
+                if (available - bytes >= pool_min_block) pool_link(pool, static_cast<Bookkeeper*>(ptr_add(node, bytes)), available - bytes);
+                else
+                {
+                        bytes = available;
+                        tag_of(ptr_add(node, bytes)) &= ~tag_prev_free;
+                }
+
+                node->tag = bytes; // free blocks are always merged with their neighbours, so the previous one is in use
+                return node;
+        }
+
+        // Starts bump allocating from [begin, end), the last word of the range holds a sentinel tag that's never freed
+        inline static void pool_reset(MemoryPool* pool, void* begin, void* end)
+        {
+                pool->current = ptr_add(begin, alignment_needed(begin));
+                pool->end = static_cast<char*>(end) - sizeof(size_t);
+                tag_of(pool->end) = 0;
+        }
+
+        // Chains a chunk able to hold at least the given block, what's left of the current one is bookkept
+        inline static void pool_grow(MemoryPool* pool, size_t bytes)
+        {
+                size_t left = static_cast<char*>(pool->end) - static_cast<char*>(pool->current);
+                if (left >= pool_min_block)
+                {
+                        pool_link(pool, static_cast<Bookkeeper*>(pool->current), left);
+                        tag_of(pool->end) |= tag_prev_free;
+                }
+                else if (left > 0) tag_of(pool->current) = left; // too small to ever be used, stays allocated
+
+                // Chunks double in size, so a small initial pool only takes a few of them to grow large
+                size_t size = sizeof(PoolChunk) + sizeof(void*) + bytes + sizeof(size_t);
+                if (size < pool->chunk_size) size = pool->chunk_size;
+                pool->chunk_size = 2 * size;
+
+                PoolChunk* chunk = static_cast<PoolChunk*>(std::malloc(size));
+                chunk->next = pool->chunks;
+                pool->chunks = chunk;
+                pool_reset(pool, ptr_add(chunk, sizeof(PoolChunk)), ptr_add(chunk, size));
+        }
+
+        inline static void pool_count_use(MemoryPool* pool, size_t bytes)
+        {
+                size_t in_use = pool->counters.bytes_in_use.load(std::memory_order_relaxed) + bytes;
+                pool->counters.bytes_in_use.store(in_use, std::memory_order_relaxed);
+                if (in_use > pool->counters.high_water.load(std::memory_order_relaxed))
+                        pool->counters.high_water.store(in_use, std::memory_order_relaxed);
+        }
+
+        /*
+        Description: allocates bytes from the pool, bump allocating while the current chunk has room, then reusing freed blocks, then chaining another chunk
+        Remark: the returned address is pointer aligned and preceded by the block's one word tag
+        */
+        inline static void* pool_allocate(MemoryPool* pool, size_t bytes)
+        {
+                // Sizes are rounded up to whole granules so any freed block can be split and bookkept
+                size_t actual_bytes = block_size(bytes);
+
+                // Would bumping the pointer by the required amount cause buffer overflow?
+                void* block = pool->current;
+                void* next = ptr_add(block, actual_bytes);
+                if (next > pool->end || next < block)
+                {
+                        // Chunk is full, reuse a freed block, alignment checks not needed here, it's already aligned
+                        block = pool_take(pool, actual_bytes);
+                        if (block != nullptr)
+                        {
+                                count(pool->counters.free_list_hits, 1);
+                                pool_count_use(pool, tag_of(block));
+                                return ptr_add(block, sizeof(size_t));
+                        }
+
+                        // No room left at all, chain another chunk
+                        pool_grow(pool, actual_bytes);
+                        count(pool->counters.chunk_hits, 1);
+                        block = pool->current;
+                        next = ptr_add(block, actual_bytes);
+                }
+                else count(pool->counters.bump_hits, 1);
+
+                pool->current = next;
+                tag_of(block) = actual_bytes; // the block before the bump pointer is never free
+                pool_count_use(pool, actual_bytes);
+
+                return ptr_add(block, sizeof(size_t));
+        }
+
+        // Returns memory obtained from pool_allocate, the block's own tag knows its size
+        inline static void pool_deallocate(MemoryPool* pool, void* address)
+        {
+                void* block = static_cast<char*>(address) - sizeof(size_t);
+                count(pool->counters.bytes_in_use, size_t(0) - (tag_of(block) & ~tag_flags));
+                pool_store(pool, block);
+        }
+
+        /*
+        Description: creates a block of memory that can be used by allocators, larger and larger chunks are chained to it when it fills up
+        Remark: DestroyMemoryPool must be called on it after using it, otherwise the memory will leak
+        */
+        inline MemoryPool* MakeMemoryPool(size_t size)
         {
                 size_t actual = size + sizeof(MemoryPool);
                 MemoryPool* pool = (MemoryPool*) std::malloc(actual);
-                pool->end = (char*) pool + actual;
-                pool->current = (char*) pool + sizeof(MemoryPool);
-                pool->bk_first = nullptr;
+                pool->chunk_size = actual;
+                pool->chunks = nullptr;
+                for (unsigned int k = 0; k < size_classes; ++k) pool->free_lists[k] = nullptr;
+                for (unsigned int k = 0; k < size_classes / 32; ++k) pool->free_masks[k] = 0;
+                new (&pool->counters) PoolCounters();
+                pool_reset(pool, ptr_add(pool, sizeof(MemoryPool)), ptr_add(pool, actual));
 
                 return pool;
         }
 
+        // Reads the counters of the pool, safe to call from any thread while the pool is in use
+        inline PoolStats GetPoolStats(const MemoryPool* pool)
+        {
+                const PoolCounters& counters = pool->counters;
+                PoolStats stats;
+                stats.bytes_in_use = counters.bytes_in_use.load(std::memory_order_relaxed);
+                stats.high_water = counters.high_water.load(std::memory_order_relaxed);
+                stats.bump_hits = counters.bump_hits.load(std::memory_order_relaxed);
+                stats.free_list_hits = counters.free_list_hits.load(std::memory_order_relaxed);
+                stats.chunk_hits = counters.chunk_hits.load(std::memory_order_relaxed);
+                stats.free_blocks = counters.free_blocks.load(std::memory_order_relaxed);
+                for (unsigned int k = 0; k < search_buckets; ++k)
+                        stats.search_lengths[k] = counters.search_lengths[k].load(std::memory_order_relaxed);
+                return stats;
+        }
+
+        // Frees the pool along with every chunk chained to it
+        inline void DestroyMemoryPool(MemoryPool* pool)
+        {
+                for (PoolChunk* chunk = pool->chunks; chunk != nullptr;)
+                {
+                        PoolChunk* next = chunk->next;
+                        std::free(chunk);
+                        chunk = next;
+                }
+                std::free(pool);
+        }
+
         /*
-        This allocator is blazingly fast until it runs out of pool memory, after that it will be as fast as the standard allocator plus some overhead.
-        Freeing memory will speed it back up a bit, however if the sizes of the allocations vary a lot memory fragmentation will become a serious issue.
+        This allocator is blazingly fast while it can bump allocate, freed blocks are merged with their free neighbours and kept in size segregated lists, so reusing them takes constant time.
+        Once every chunk is full another one is chained to the pool, so it never falls back to the standard allocator.
         REMARK: When using this allocator with a container (like STL) you will have to ensure that the pool's memory will be available until all containers using it are DESTROYED.
         REMARK: For STL containers, a constructed instance of the allocator should be passed a parameter to the container's constructor, otherwise states will not work
-        REMARK: If no memory pool is provided, the standard allocator will be used instead
-        TODO: Concatenate adjacent memory in bookkeeping list, haven't thought of a good way of doing this yet
+        REMARK: Every allocation carries a one word header
         */
         template <typename T>
         struct SmartPoolAllocator
         {
-                std::allocator<T> fallback;
                 MemoryPool* pool;
 
                 // Requirements for standard conformity, also allows this to work with STL containers
@@ -80,81 +410,17 @@ namespace ORC_NAMESPACE
 
                 T* allocate(size_t size, void* = 0)
                 {
-                        // If the requested size is too small we have to live with either not being able to use bookkeeping or over allocate
-                        size_t requested_bytes = size * sizeof(T);
-                        size_t actual_bytes = requested_bytes > sizeof(Bookkeeper) ? requested_bytes : sizeof(Bookkeeper);
-
-                        // First of all, alignment requirements are checked, we can ignore the original pointer since std::free wont be needing it
-                        size_t align_size = alignment_needed(pool->current);
-                        T* address = static_cast<T*>(ptr_add(pool->current, align_size));
-
-                        // Next, would offsetting the pointer by the required amount cause buffer overflow?
-                        void* next = ptr_add(address, actual_bytes);
-                        if (next >= pool->end)
-                        {
-                                // Pool is full, search for available rooms
-                                Bookkeeper* prev = nullptr;
-                                Bookkeeper* node = pool->bk_first;
-                                while (node)
-                                {
-                                        if (node->size >= actual_bytes) // Does it fit? Alignment checks not needed here, it's already aligned
-                                        {
-#ifdef SMART_ALLOCATOR_DIAGNOSTICS
-                                                        std::cout << "Bookkeeping: claimed " << node->size << " bytes at [0x" << node << ']' << std::endl;
-#endif
-
-                                                // Make the previous node point to the next node
-                                                if (prev != nullptr) prev->next = node->next;
-                                                // First node in the list, make the head point to the next element
-                                                else pool->bk_first = node->next;
-
-                                                return reinterpret_cast<T*>(node);
-                                        }
-
-                                        prev = node;
-                                        node = node->next;
-                                }
-
-                                // No room to perform allocation, use fallback allocator
-#ifdef SMART_ALLOCATOR_DIAGNOSTICS
-                                        std::cout << "Allocation: no memory, using fallback allocator" << std::endl;
-#endif
-
-                                return fallback.allocate(size);
-                        }
-
-                        pool->current = next;
-
-#ifdef SMART_ALLOCATOR_DIAGNOSTICS
-                                std::cout << "Allocation: " << actual_bytes << " bytes requested at [0x" << pool->current << ']' << std::endl;
-#endif
-
-                        return address;
+                        return static_cast<T*>(pool_allocate(pool, size * sizeof(T)));
                 }
 
-                void deallocate(T* address, size_t n)
+                void deallocate(T* address, size_t)
                 {
-                        // If the address is not inside the block used by the pool, assume it's from the fallback allocator
-                        if (reinterpret_cast<void*>(address) < reinterpret_cast<void*>(pool) ||
-                            reinterpret_cast<void*>(address) > pool->end)
-                        {
-#ifdef SMART_ALLOCATOR_DIAGNOSTICS
-                                        std::cout << "Deallocate: memory from fallback allocator" << std::endl;
-#endif
-
-                                fallback.deallocate(address, n);
-                                return;
-                        }
-
-                        // Otherwise, add the returned memory to bookkeeping
-                        Bookkeeper* node = reinterpret_cast<Bookkeeper*>(address);
-                        node->next = pool->bk_first;
-                        node->size = (n * sizeof(T)) > sizeof(Bookkeeper) ? (n * sizeof(T)) : sizeof(Bookkeeper);
-                        pool->bk_first = node;
+                        pool_deallocate(pool, address);
+                }
 
-#ifdef SMART_ALLOCATOR_DIAGNOSTICS
-                                std::cout << "Bookkeeping: stored " << node->size << " bytes at [0x" << address << ']' << std::endl;
-#endif
+                PoolStats Stats() const
+                {
+                        return GetPoolStats(pool);
                 }
 
         };
@@ -0,0 +1,179 @@
+#ifndef _THREAD_POOL_H
+#define _THREAD_POOL_H
+
+#include "config.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ORC_NAMESPACE
+{
+
+        /*
+        Counts the unfinished tasks that were started through it, tasks may start more tasks in the same group
+        */
+        class TaskGroup
+        {
+                friend class ThreadPool;
+                std::atomic<size_t> pending;
+
+        public:
+
+                TaskGroup()
+                {
+                        pending = 0;
+                }
+
+                bool Done() const
+                {
+                        return pending.load() == 0;
+                }
+        };
+
+        /*
+        Work stealing thread pool: every worker owns a queue, runs its own tasks newest first and steals the oldest tasks of the others when it runs dry.
+        Tasks started from threads outside of the pool go to a shared queue that every worker steals from.
+        REMARK: Wait helps running tasks instead of blocking, so it's safe to call from inside a task
+        */
+        class ThreadPool
+        {
+                struct Task
+                {
+                        std::function<void()> function;
+                        TaskGroup* group;
+                };
+
+                struct Queue
+                {
+                        std::mutex lock;
+                        std::deque<Task> tasks;
+                };
+
+                std::vector<std::thread> workers;
+                std::vector<std::unique_ptr<Queue>> queues; // one per worker, the last one is shared by outside threads
+                std::atomic<size_t> queued;
+                std::atomic<bool> quit;
+                std::mutex sleep_lock;
+                std::condition_variable wake;
+
+                // Queue owned by the calling thread, the shared one if it isn't a worker
+                size_t home() const
+                {
+                        std::thread::id id = std::this_thread::get_id();
+                        for (size_t k = 0; k < workers.size(); ++k)
+                        {
+                                if (workers[k].get_id() == id) return k;
+                        }
+                        return workers.size();
+                }
+
+                bool pop(size_t index, Task& task, bool newest)
+                {
+                        Queue& queue = *queues[index];
+                        std::lock_guard<std::mutex> guard(queue.lock);
+                        if (queue.tasks.empty()) return false;
+
+                        if (newest)
+                        {
+                                task = std::move(queue.tasks.back());
+                                queue.tasks.pop_back();
+                        }
+                        else
+                        {
+                                task = std::move(queue.tasks.front());
+                                queue.tasks.pop_front();
+                        }
+                        --queued;
+                        return true;
+                }
+
+                // Runs one task, preferring the caller's own queue, returns false if there was nothing to do
+                bool run_one(size_t own)
+                {
+                        Task task;
+                        bool found = pop(own, task, true);
+                        for (size_t k = 1; !found && k < queues.size(); ++k)
+                                found = pop((own + k) % queues.size(), task, false);
+                        if (!found) return false;
+
+                        task.function();
+                        --task.group->pending;
+                        return true;
+                }
+
+                void work(size_t index)
+                {
+                        while (!quit)
+                        {
+                                if (run_one(index)) continue;
+
+                                std::unique_lock<std::mutex> guard(sleep_lock);
+                                wake.wait(guard, [this] { return quit || queued > 0; });
+                        }
+                }
+
+        public:
+
+                explicit ThreadPool(unsigned int threads = std::thread::hardware_concurrency())
+                {
+                        if (threads == 0) threads = 1;
+                        queued = 0;
+                        quit = false;
+                        for (unsigned int k = 0; k <= threads; ++k) queues.emplace_back(new Queue());
+                        for (unsigned int k = 0; k < threads; ++k) workers.emplace_back(&ThreadPool::work, this, k);
+                }
+
+                ~ThreadPool()
+                {
+                        {
+                                std::lock_guard<std::mutex> guard(sleep_lock);
+                                quit = true;
+                        }
+                        wake.notify_all();
+                        for (std::thread& worker : workers) worker.join();
+                }
+
+                ThreadPool(const ThreadPool&) = delete;
+                ThreadPool& operator=(const ThreadPool&) = delete;
+
+                void Run(TaskGroup& group, std::function<void()> function)
+                {
+                        ++group.pending;
+                        Task task = {std::move(function), &group};
+                        Queue& queue = *queues[home()];
+                        {
+                                std::lock_guard<std::mutex> guard(queue.lock);
+                                queue.tasks.push_back(std::move(task));
+                        }
+                        {
+                                std::lock_guard<std::mutex> guard(sleep_lock);
+                                ++queued;
+                        }
+                        wake.notify_one();
+                }
+
+                // Returns once every task of the group, including the ones they started, has finished
+                void Wait(TaskGroup& group)
+                {
+                        size_t own = home();
+                        while (!group.Done())
+                        {
+                                if (!run_one(own)) std::this_thread::yield();
+                        }
+                }
+
+                unsigned int Size() const
+                {
+                        return static_cast<unsigned int>(workers.size());
+                }
+        };
+
+};
+
+#endif // _THREAD_POOL_H
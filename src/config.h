@@ -3,4 +3,11 @@
 
 #define ORC_NAMESPACE orc
 
+// Visual Studio 2013 has no thread_local, its own storage class only works for plain data which is all that's ever stored this way
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define ORC_THREAD_LOCAL __declspec(thread)
+#else
+#define ORC_THREAD_LOCAL thread_local
+#endif
+
 #endif // _CONFIG_H
@@ -1,5 +1,6 @@
 #include <SDL2/SDL.h>
 #include <GL/glew.h>
+#include <atomic>
 #include <thread>
 
 #pragma comment(lib, "sdl2.lib")
@@ -15,8 +16,6 @@ int my;
 
 static bool quit = false;
 
-// #define SMART_ALLOCATOR_DIAGNOSTICS
-
 #include "../src/QuadTreeRenderer.h"
 #include "../src/SmartPoolAllocator.h"
 
@@ -47,24 +46,36 @@ orc::QuadTreeRenderer<vec_p, alloc>* tree;
 
 bool insert = true;
 
-vec_p* mov;
+orc::QuadTreeHandle mov;
+
+// Depth of the tree as of the last publish, Stats walks the live tree so only the main thread may call it
+std::atomic<size_t> published_depth(0);
+
+void publish()
+{
+        tree->Publish();
+        published_depth = tree->Stats().depth;
+}
 
+// Runs on the render thread, it only reads the snapshot published last while the main thread keeps changing the tree
 void render()
 {
         const int width = 49;
         orc::AABB ms(vec2(mx - width, my - width), vec2(mx + width, my + width));
         ms.Render(backbuffer, 0xFFFFFFFF);
 
-        tree->Render(backbuffer);
+        auto snapshot = tree->Acquire();
+        if (!snapshot) return;
 
-        auto points = tree->Query(ms);
+        snapshot->ForEachLeaf([](const orc::AABB& region) { region.Render(backbuffer, 0xFFFFFFFF); });
+
+        auto points = snapshot->Query(ms);
         for (auto ptr : points)
         {
                 orc::util::Render(ptr->Position(), backbuffer, 0xFF0000FF);
         }
 
-        mov = tree->Move(mov, {X, Y});
-        orc::util::Render(mov->Position(), backbuffer, 0xFF00FF00);
+        orc::util::Render(vec2(X, Y), backbuffer, 0xFF00FF00);
 
 }
 
@@ -84,6 +95,7 @@ int main(int argc, char**argv)
         }
 
         mov = tree->Insert({{X, Y}});
+        publish();
 
         SDL_Window* wnd = SDL_CreateWindow("Demo", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 800, 600, SDL_WINDOW_OPENGL);
 
@@ -95,15 +107,17 @@ int main(int argc, char**argv)
 
                 while (!quit)
                 {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+
                         std::cout << (frameID - last) << std::endl;
                         last = frameID;
 
-                        auto aabb = tree->Region();
+                        auto snapshot = tree->Acquire();
+                        if (!snapshot) continue;
+                        auto aabb = snapshot->Region();
                         vec2 tr = aabb.TopRight();
                         vec2 bl = aabb.BottomLeft();
-                        std::cout << "Region: (" << bl.x << ", " << bl.y << "); (" << tr.x << ", " << tr.y << ") Depth = " << 0 << std::endl;
-
-                        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+                        std::cout << "Region: (" << bl.x << ", " << bl.y << "); (" << tr.x << ", " << tr.y << ") Size = " << snapshot->Size() << " Depth = " << published_depth << std::endl;
                 }
 
         });
@@ -143,6 +157,8 @@ int main(int argc, char**argv)
                         X = mx;
                         Y = my;
 
+                        tree->Move(mov, {X, Y});
+                        publish();
                         break;
                 case SDL_MOUSEBUTTONDOWN:
                         if (e.button.button == 1)
@@ -153,6 +169,7 @@ int main(int argc, char**argv)
                                         item.position.x = e.button.x;
                                         item.position.y = 599 - e.button.y;
                                         tree->Insert(item);
+                                        publish();
                                 }
                         }
                         else if (e.button.button == 3)
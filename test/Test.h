@@ -0,0 +1,99 @@
+#ifndef _TEST_H
+#define _TEST_H
+
+#include "../src/AABB.h"
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+/*
+Minimal test harness of the quadtree_tests target: TEST registers a case, CHECK records a failure without stopping the case
+*/
+
+namespace test
+{
+        typedef void (*TestFunction)();
+
+        struct TestCase
+        {
+                const char* name;
+                TestFunction function;
+        };
+
+        inline std::vector<TestCase>& Registry()
+        {
+                static std::vector<TestCase> cases;
+                return cases;
+        }
+
+        struct Registrar
+        {
+                Registrar(const char* name, TestFunction function)
+                {
+                        TestCase entry = {name, function};
+                        Registry().push_back(entry);
+                }
+        };
+
+        inline size_t& Failures()
+        {
+                static size_t failures = 0;
+                return failures;
+        }
+
+        inline void Fail(const char* file, int line, const char* condition)
+        {
+                std::printf("%s(%d): CHECK(%s) failed\n", file, line, condition);
+                ++Failures();
+        }
+
+        // Element stored by the trees under test, trivially copyable so it can go through Save and Load
+        struct Point
+        {
+                vec2 position;
+                unsigned int id;
+
+                const vec2& Position() const
+                {
+                        return position;
+                }
+
+                void Position(const vec2& pos)
+                {
+                        position = pos;
+                }
+        };
+
+        inline float Random(std::mt19937& rng, float low, float high)
+        {
+                return std::uniform_real_distribution<float>(low, high)(rng);
+        }
+
+        inline std::vector<Point> RandomPoints(std::mt19937& rng, size_t count, float low, float high)
+        {
+                std::vector<Point> points;
+                for (size_t k = 0; k < count; ++k)
+                {
+                        Point point = {vec2(Random(rng, low, high), Random(rng, low, high)), static_cast<unsigned int>(k)};
+                        points.push_back(point);
+                }
+                return points;
+        }
+
+        inline orc::AABB RandomBox(std::mt19937& rng, float low, float high, float max_extent)
+        {
+                vec2 corner(Random(rng, low, high), Random(rng, low, high));
+                return orc::AABB(corner, corner + vec2(Random(rng, 0.0f, max_extent), Random(rng, 0.0f, max_extent)));
+        }
+}
+
+#define TEST(name) \
+        static void name(); \
+        static test::Registrar name##_registrar(#name, name); \
+        static void name()
+
+#define CHECK(condition) \
+        do { if (!(condition)) test::Fail(__FILE__, __LINE__, #condition); } while (0)
+
+#endif // _TEST_H
@@ -0,0 +1,262 @@
+#include "Test.h"
+#include "../src/CachingPoolAllocator.h"
+#include "../src/QuadTree.h"
+#include "../src/SmartPoolAllocator.h"
+
+#include <algorithm>
+#include <iterator>
+#include <mutex>
+#include <thread>
+
+using test::Point;
+
+namespace
+{
+        struct Block
+        {
+                unsigned char* data;
+                size_t size;
+                unsigned char fill;
+        };
+
+        void Fill(const Block& block)
+        {
+                std::fill(block.data, block.data + block.size, block.fill);
+        }
+
+        // True if nothing else wrote over the block since it was filled
+        bool Intact(const Block& block)
+        {
+                return std::count(block.data, block.data + block.size, block.fill) == static_cast<std::ptrdiff_t>(block.size);
+        }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+TEST(SmartPoolMergesFreedNeighbours)
+{
+        orc::MemoryPool* pool = orc::MakeMemoryPool(1 << 20);
+        orc::SmartPoolAllocator<unsigned char> allocator(pool);
+
+        std::vector<unsigned char*> blocks;
+        for (size_t k = 0; k < 101; ++k) blocks.push_back(allocator.allocate(100));
+        const size_t in_use = allocator.Stats().bytes_in_use;
+        CHECK(allocator.Stats().bump_hits == 101);
+
+        // Every other block leaves a hole of its own, the last block keeps them away from the bump pointer
+        for (size_t k = 0; k < 100; k += 2) allocator.deallocate(blocks[k], 100);
+        CHECK(allocator.Stats().free_blocks == 50);
+
+        // Freeing the blocks in between merges everything into a single block
+        for (size_t k = 1; k < 100; k += 2) allocator.deallocate(blocks[k], 100);
+        CHECK(allocator.Stats().free_blocks == 1);
+        CHECK(allocator.Stats().bytes_in_use == in_use / 101);
+
+        // The last block goes back to the bump region along with the free block before it
+        allocator.deallocate(blocks[100], 100);
+        CHECK(allocator.Stats().free_blocks == 0);
+        CHECK(allocator.Stats().bytes_in_use == 0);
+        CHECK(allocator.allocate(100) == blocks[0]);
+        orc::DestroyMemoryPool(pool);
+}
+
+TEST(SmartPoolSurvivesRandomTraffic)
+{
+        // A tiny pool, so most of the traffic goes through chained chunks
+        std::mt19937 rng(14);
+        orc::MemoryPool* pool = orc::MakeMemoryPool(1024);
+        orc::SmartPoolAllocator<unsigned char> allocator(pool);
+
+        std::vector<Block> live;
+        bool intact = true;
+        for (size_t step = 0; step < 50000; ++step)
+        {
+                if (live.empty() || rng() % 100 < 55)
+                {
+                        const size_t size = rng() % 8 == 0 ? 1 + rng() % 4000 : 1 + rng() % 120;
+                        Block block = {allocator.allocate(size), size, static_cast<unsigned char>(rng())};
+                        intact = intact && reinterpret_cast<size_t>(block.data) % sizeof(void*) == 0;
+                        Fill(block);
+                        live.push_back(block);
+                }
+                else
+                {
+                        const size_t index = rng() % live.size();
+                        intact = intact && Intact(live[index]);
+                        allocator.deallocate(live[index].data, live[index].size);
+                        live[index] = live.back();
+                        live.pop_back();
+                }
+        }
+
+        for (const Block& block : live) intact = intact && Intact(block);
+        CHECK(intact);
+
+        const orc::PoolStats busy = allocator.Stats();
+        CHECK(busy.chunk_hits > 0 && busy.free_list_hits > 0 && busy.bump_hits > 0);
+        CHECK(busy.high_water >= busy.bytes_in_use);
+
+        for (const Block& block : live) allocator.deallocate(block.data, block.size);
+        CHECK(allocator.Stats().bytes_in_use == 0);
+        orc::DestroyMemoryPool(pool);
+}
+
+TEST(SmartPoolBacksATree)
+{
+        std::mt19937 rng(15);
+        orc::MemoryPool* pool = orc::MakeMemoryPool(4096);
+        {
+                orc::SmartPoolAllocator<Point> allocator(pool);
+                orc::QuadTree<Point, orc::SmartPoolAllocator<Point>> tree(orc::AABB(vec2(0.0f, 0.0f), vec2(1024.0f, 1024.0f)), allocator, 6);
+
+                std::vector<Point> model = test::RandomPoints(rng, 4000, 0.0f, 1024.0f);
+                std::vector<orc::QuadTreeHandle> handles;
+                for (const Point& point : model) handles.push_back(tree.Insert(point));
+
+                // Splits, merges and leaf growth all return memory to the pool in between
+                for (size_t round = 0; round < 3; ++round)
+                {
+                        for (size_t k = model.size(); k-- > 0;)
+                        {
+                                if (rng() % 3 == 0)
+                                {
+                                        tree.Remove(handles[k]);
+                                        model.erase(model.begin() + k);
+                                        handles.erase(handles.begin() + k);
+                                }
+                                else
+                                {
+                                        model[k].position = vec2(test::Random(rng, 0.0f, 1024.0f), test::Random(rng, 0.0f, 1024.0f));
+                                        tree.Move(handles[k], model[k].position);
+                                }
+                        }
+                        for (size_t k = 0; k < 1000; ++k)
+                        {
+                                Point point = {vec2(test::Random(rng, 0.0f, 1024.0f), test::Random(rng, 0.0f, 1024.0f)), static_cast<unsigned int>(4000 + 1000 * round + k)};
+                                model.push_back(point);
+                                handles.push_back(tree.Insert(point));
+                        }
+                }
+
+                CHECK(tree.Size() == model.size());
+                for (size_t q = 0; q < 100; ++q)
+                {
+                        const orc::AABB box = test::RandomBox(rng, 0.0f, 1024.0f, 300.0f);
+                        size_t expected = 0;
+                        for (const Point& point : model) expected += box.Inside(point.position);
+                        CHECK(tree.Query(box).size() == expected);
+                }
+                for (size_t k = 0; k < model.size(); ++k)
+                {
+                        const Point* point = tree.Get(handles[k]);
+                        CHECK(point != nullptr && point->id == model[k].id && point->position == model[k].position);
+                }
+        }
+        CHECK(orc::GetPoolStats(pool).bytes_in_use == 0);
+        orc::DestroyMemoryPool(pool);
+}
+
+TEST(CachingPoolTakesRemoteFrees)
+{
+        const unsigned int thread_count = 4;
+        orc::SharedMemoryPool* arena = orc::MakeSharedMemoryPool(4096);
+
+        // Every thread frees about half of its blocks itself and hands the others to the next thread
+        std::vector<Block> handed[thread_count];
+        std::mutex locks[thread_count];
+        std::atomic<unsigned int> finished(0);
+        std::atomic<size_t> damaged(0);
+
+        std::vector<std::thread> threads;
+        for (unsigned int t = 0; t < thread_count; ++t)
+        {
+                threads.emplace_back([&, t]()
+                {
+                        orc::CachingPoolAllocator<unsigned char> allocator(arena);
+                        std::mt19937 rng(16 + t);
+                        std::vector<Block> live;
+                        for (size_t step = 0; step < 20000; ++step)
+                        {
+                                if (live.empty() || rng() % 100 < 55)
+                                {
+                                        const size_t size = 1 + rng() % 200;
+                                        Block block = {allocator.allocate(size), size, static_cast<unsigned char>(rng())};
+                                        Fill(block);
+                                        live.push_back(block);
+                                        continue;
+                                }
+
+                                const size_t index = rng() % live.size();
+                                if (!Intact(live[index])) ++damaged;
+                                if (rng() % 2 == 0) allocator.deallocate(live[index].data, live[index].size);
+                                else
+                                {
+                                        std::lock_guard<std::mutex> guard(locks[(t + 1) % thread_count]);
+                                        handed[(t + 1) % thread_count].push_back(live[index]);
+                                }
+                                live[index] = live.back();
+                                live.pop_back();
+
+                                // Blocks handed over by the previous thread are freed here, away from their owner
+                                std::vector<Block> received;
+                                {
+                                        std::lock_guard<std::mutex> guard(locks[t]);
+                                        received.swap(handed[t]);
+                                }
+                                for (const Block& block : received)
+                                {
+                                        if (!Intact(block)) ++damaged;
+                                        allocator.deallocate(block.data, block.size);
+                                }
+                        }
+                        for (const Block& block : live) allocator.deallocate(block.data, block.size);
+
+                        // Once every thread is done freeing, one more allocation takes back what the others freed remotely
+                        ++finished;
+                        while (finished < thread_count) std::this_thread::yield();
+                        {
+                                std::lock_guard<std::mutex> guard(locks[t]);
+                                for (const Block& block : handed[t]) allocator.deallocate(block.data, block.size);
+                                handed[t].clear();
+                        }
+                        ++finished;
+                        while (finished < 2 * thread_count) std::this_thread::yield();
+                        allocator.deallocate(allocator.allocate(1), 1);
+                });
+        }
+        for (std::thread& thread : threads) thread.join();
+
+        CHECK(damaged == 0);
+        const orc::PoolStats stats = orc::GetSharedPoolStats(arena);
+        CHECK(stats.bytes_in_use == 0);
+        CHECK(stats.chunk_hits > 0 && stats.free_list_hits > 0);
+        orc::DestroySharedMemoryPool(arena);
+}
+
+TEST(CachingPoolBacksAParallelBuild)
+{
+        std::mt19937 rng(20);
+        const std::vector<Point> points = test::RandomPoints(rng, 60000, 0.0f, 1024.0f);
+        orc::SharedMemoryPool* arena = orc::MakeSharedMemoryPool(1 << 16);
+        {
+                orc::ThreadPool pool(4);
+                orc::CachingPoolAllocator<Point> allocator(arena);
+                orc::QuadTree<Point, orc::CachingPoolAllocator<Point>> tree(orc::AABB(vec2(0.0f, 0.0f), vec2(1.0f, 1.0f)), allocator, 8);
+                std::vector<orc::QuadTreeHandle> handles;
+                tree.ParallelBuild(points.begin(), points.end(), pool, std::back_inserter(handles));
+                CHECK(tree.Size() == points.size());
+
+                for (size_t q = 0; q < 50; ++q)
+                {
+                        const orc::AABB box = test::RandomBox(rng, 0.0f, 1024.0f, 300.0f);
+                        size_t expected = 0;
+                        for (const Point& point : points) expected += box.Inside(point.position);
+                        CHECK(tree.Query(box).size() == expected);
+                }
+
+                // Removing from this thread frees blocks allocated by the pool's threads
+                for (size_t k = 0; k < handles.size(); k += 2) tree.Remove(handles[k]);
+                CHECK(tree.Size() == points.size() / 2);
+        }
+        orc::DestroySharedMemoryPool(arena);
+}
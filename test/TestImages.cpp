@@ -0,0 +1,172 @@
+#include "Test.h"
+#include "../src/QuadTree.h"
+#include "../src/QuadTreeImage.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+
+using test::Point;
+
+namespace
+{
+        const char* const image_path = "quadtree_tests.img";
+
+        // Element of another size, images of Point must be refused for it
+        struct WidePoint
+        {
+                vec2 position;
+                unsigned int id;
+                unsigned int tag;
+
+                const vec2& Position() const
+                {
+                        return position;
+                }
+
+                void Position(const vec2& pos)
+                {
+                        position = pos;
+                }
+        };
+
+        template <typename pointer_range>
+        std::vector<unsigned int> Ids(const pointer_range& items)
+        {
+                std::vector<unsigned int> ids;
+                for (auto item : items) ids.push_back(item->id);
+                std::sort(ids.begin(), ids.end());
+                return ids;
+        }
+
+        std::vector<unsigned char> ReadFile(const char* path)
+        {
+                std::vector<unsigned char> bytes;
+                FILE* file = std::fopen(path, "rb");
+                if (file == nullptr) return bytes;
+
+                unsigned char block[4096];
+                for (size_t read; (read = std::fread(block, 1, sizeof(block), file)) > 0;) bytes.insert(bytes.end(), block, block + read);
+                std::fclose(file);
+                return bytes;
+        }
+
+        bool WriteFile(const char* path, const std::vector<unsigned char>& bytes)
+        {
+                FILE* file = std::fopen(path, "wb");
+                if (file == nullptr) return false;
+                bool written = std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+                return std::fclose(file) == 0 && written;
+        }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+TEST(SavedImagesLoadAndViewUnchanged)
+{
+        std::mt19937 rng(12);
+        std::vector<Point> points = test::RandomPoints(rng, 3000, 0.0f, 1024.0f);
+        for (unsigned int k = 0; k < 50; ++k)
+        {
+                Point point = {vec2(512.0f, 256.0f), static_cast<unsigned int>(points.size())};
+                points.push_back(point);
+        }
+        orc::QuadTree<Point> tree(orc::AABB(vec2(0.0f, 0.0f), vec2(1024.0f, 1024.0f)), 6);
+        for (const Point& point : points) tree.Insert(point);
+        CHECK(tree.Save(image_path));
+
+        orc::QuadTree<Point> loaded(orc::AABB(vec2(0.0f, 0.0f), vec2(1.0f, 1.0f)), 6);
+        loaded.Insert(points[0]);
+        std::vector<orc::QuadTreeHandle> handles;
+        CHECK(loaded.Load(image_path, std::back_inserter(handles)));
+        CHECK(loaded.Size() == tree.Size() && handles.size() == tree.Size());
+        CHECK(loaded.Region().BottomLeft() == tree.Region().BottomLeft() && loaded.Region().TopRight() == tree.Region().TopRight());
+
+        std::vector<const Point*> reached;
+        for (const orc::QuadTreeHandle& handle : handles) reached.push_back(loaded.Get(handle));
+        std::vector<unsigned int> all;
+        for (const Point& point : points) all.push_back(point.id);
+        CHECK(Ids(reached) == all);
+
+        orc::QuadTreeView<Point> mapped;
+        CHECK(mapped.Open(image_path, true));
+        CHECK(mapped.Size() == tree.Size());
+
+        const std::vector<unsigned char> bytes = ReadFile(image_path);
+        orc::QuadTreeView<Point> buffered;
+        CHECK(buffered.Open(bytes.data(), bytes.size()));
+
+        for (size_t q = 0; q < 200; ++q)
+        {
+                const orc::AABB box = test::RandomBox(rng, -100.0f, 1024.0f, 400.0f);
+                const std::vector<unsigned int> expected = Ids(tree.Query(box));
+                CHECK(Ids(loaded.Query(box)) == expected);
+                CHECK(Ids(mapped.Query(box)) == expected);
+                CHECK(Ids(buffered.Query(box)) == expected);
+        }
+
+        // Loaded trees keep working as usual
+        loaded.Remove(handles[0]);
+        loaded.Move(handles[1], vec2(2000.0f, 2000.0f));
+        CHECK(loaded.Size() == tree.Size() - 1);
+        CHECK(loaded.Query(orc::AABB(vec2(1999.0f, 1999.0f), vec2(2001.0f, 2001.0f))).size() == 1);
+        std::remove(image_path);
+}
+
+TEST(MalformedImagesAreRefused)
+{
+        std::mt19937 rng(13);
+        const std::vector<Point> points = test::RandomPoints(rng, 500, 0.0f, 100.0f);
+        orc::QuadTree<Point> tree(orc::AABB(vec2(0.0f, 0.0f), vec2(100.0f, 100.0f)), 4);
+        for (const Point& point : points) tree.Insert(point);
+        CHECK(tree.Save(image_path));
+        const std::vector<unsigned char> bytes = ReadFile(image_path);
+        CHECK(!bytes.empty());
+
+        // Another element size, through both the view and Load, which must leave the tree untouched
+        orc::QuadTreeView<WidePoint> wide_view;
+        CHECK(!wide_view.Open(bytes.data(), bytes.size()));
+        orc::QuadTree<WidePoint> wide(orc::AABB(vec2(0.0f, 0.0f), vec2(100.0f, 100.0f)), 4);
+        WidePoint kept = {vec2(1.0f, 2.0f), 7, 8};
+        wide.Insert(kept);
+        CHECK(!wide.Load(image_path));
+        CHECK(wide.Size() == 1);
+
+        // A buffer that isn't aligned for the nodes and elements
+        std::vector<unsigned char> shifted(bytes.size() + 1);
+        std::copy(bytes.begin(), bytes.end(), shifted.begin() + 1);
+        orc::QuadTreeView<Point> view;
+        CHECK(!view.Open(shifted.data() + 1, bytes.size()));
+
+        // Truncated images
+        const size_t cuts[] = {0, 1, 63, 64, 65, 200, bytes.size() / 2, bytes.size() - 1};
+        for (size_t cut : cuts) CHECK(!view.Open(bytes.data(), cut));
+
+        // Every single bit flip must be caught by a verified open, wherever it lands
+        std::vector<unsigned char> corrupted = bytes;
+        size_t accepted = 0;
+        for (size_t trial = 0; trial < 2000; ++trial)
+        {
+                const size_t bit = rng() % (8 * bytes.size());
+                corrupted[bit / 8] ^= static_cast<unsigned char>(1u << (bit % 8));
+                accepted += view.Open(corrupted.data(), corrupted.size(), true);
+                corrupted[bit / 8] = bytes[bit / 8];
+        }
+        CHECK(accepted == 0);
+
+        // Without verify only the structure is checked, a flip in the last element's bytes goes through
+        corrupted.back() ^= 0x01;
+        CHECK(view.Open(corrupted.data(), corrupted.size()));
+        CHECK(!view.Open(corrupted.data(), corrupted.size(), true));
+        corrupted.back() = bytes.back();
+
+        corrupted[100] ^= 0x10;
+        CHECK(WriteFile(image_path, corrupted));
+        orc::QuadTree<Point> target(orc::AABB(vec2(0.0f, 0.0f), vec2(100.0f, 100.0f)), 4);
+        target.Insert(points[0]);
+        CHECK(!target.Load(image_path));
+        CHECK(target.Size() == 1 && target.Query(target.Region()).size() == 1);
+
+        CHECK(view.Open(bytes.data(), bytes.size(), true));
+        std::remove(image_path);
+}
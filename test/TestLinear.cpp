@@ -0,0 +1,156 @@
+#include "Test.h"
+#include "../src/LinearQuadTree.h"
+#include "../src/SmartPoolAllocator.h"
+
+#include <algorithm>
+
+using test::Point;
+
+namespace
+{
+        template <typename pointer_range>
+        std::vector<unsigned int> Ids(const pointer_range& items)
+        {
+                std::vector<unsigned int> ids;
+                for (auto item : items) ids.push_back(item->id);
+                std::sort(ids.begin(), ids.end());
+                return ids;
+        }
+
+        std::vector<unsigned int> BruteForce(const std::vector<Point>& model, const orc::AABB& box)
+        {
+                std::vector<unsigned int> ids;
+                for (const Point& point : model)
+                {
+                        if (box.Inside(point.position)) ids.push_back(point.id);
+                }
+                std::sort(ids.begin(), ids.end());
+                return ids;
+        }
+
+        // Pointers don't survive modifications, elements are looked up again by id
+        template <typename tree_type>
+        Point* Find(const tree_type& tree, unsigned int id)
+        {
+                for (Point* item : tree.Query(tree.Region()))
+                {
+                        if (item->id == id) return item;
+                }
+                return nullptr;
+        }
+
+        // Random boxes, plus the quadrants of the region so whole implicit nodes are accepted without testing their points
+        template <typename tree_type>
+        void CheckQueries(const tree_type& tree, const std::vector<Point>& model, std::mt19937& rng)
+        {
+                CHECK(tree.Size() == model.size());
+                CHECK(Ids(tree.Query(tree.Region())) == BruteForce(model, tree.Region()));
+                CHECK(BruteForce(model, tree.Region()).size() == model.size());
+                for (unsigned int k = 0; k < 4; ++k)
+                {
+                        const orc::AABB quadrant = tree.Region().Quadrant(k);
+                        CHECK(Ids(tree.Query(quadrant)) == BruteForce(model, quadrant));
+                        CHECK(Ids(tree.Query(quadrant.Quadrant(3 - k))) == BruteForce(model, quadrant.Quadrant(3 - k)));
+                }
+
+                const vec2 low = tree.Region().BottomLeft() - vec2(50.0f, 50.0f);
+                const vec2 high = tree.Region().TopRight();
+                for (size_t q = 0; q < 100; ++q)
+                {
+                        vec2 corner(test::Random(rng, low.x, high.x), test::Random(rng, low.y, high.y));
+                        const orc::AABB box(corner, corner + vec2(test::Random(rng, 0.0f, 300.0f), test::Random(rng, 0.0f, 300.0f)));
+                        CHECK(Ids(tree.Query(box)) == BruteForce(model, box));
+                }
+        }
+
+        // Build, insertions in and out of the region, moves across keys in both directions and out of the region, then removals
+        template <typename tree_type>
+        void Exercise(tree_type& tree, std::mt19937& rng)
+        {
+                std::vector<Point> model = test::RandomPoints(rng, 2000, 0.0f, 1024.0f);
+                for (unsigned int k = 0; k < 40; ++k)
+                {
+                        Point point = {vec2(512.0f, 512.0f), static_cast<unsigned int>(model.size())};
+                        model.push_back(point);
+                }
+                tree.Build(model.begin(), model.end());
+                CheckQueries(tree, model, rng);
+
+                for (unsigned int k = 0; k < 300; ++k)
+                {
+                        const bool outside = k % 15 == 0;
+                        Point point = {vec2(test::Random(rng, outside ? -1500.0f : 0.0f, outside ? 2500.0f : 1024.0f), test::Random(rng, outside ? -1500.0f : 0.0f, outside ? 2500.0f : 1024.0f)), static_cast<unsigned int>(model.size())};
+                        const Point* inserted = tree.Insert(point);
+                        CHECK(inserted != nullptr && inserted->id == point.id && inserted->position == point.position);
+                        CHECK(tree.Region().Inside(point.position));
+                        model.push_back(point);
+                }
+                CheckQueries(tree, model, rng);
+
+                for (size_t step = 0; step < 600; ++step)
+                {
+                        Point& point = model[rng() % model.size()];
+                        const orc::AABB region = tree.Region();
+                        vec2 target;
+                        switch (step % 5)
+                        {
+                        case 0: target = point.position + vec2(0.01f, -0.01f); break; // most likely the same key
+                        case 1: target = region.BottomLeft(); break; // the lowest key, rotates towards the front
+                        case 2: target = region.TopRight(); break; // the highest key, rotates towards the back
+                        case 3: target = region.BottomLeft() + region.TopRight() - point.position; break; // mirrored, either way
+                        default: // out of the region once in a while, every time grows it
+                                if (step % 100 == 4) target = step % 200 == 4 ? region.TopRight() + vec2(300.0f, 10.0f) : region.BottomLeft() - vec2(10.0f, 700.0f);
+                                else target = vec2(test::Random(rng, region.BottomLeft().x, region.TopRight().x), test::Random(rng, region.BottomLeft().y, region.TopRight().y));
+                                break;
+                        }
+
+                        Point* moved = tree.Move(Find(tree, point.id), target);
+                        point.position = target;
+                        CHECK(moved != nullptr && moved->id == point.id && moved->position == target);
+                        CHECK(tree.Region().Inside(target));
+                }
+                CheckQueries(tree, model, rng);
+
+                for (size_t step = 0; step < 500; ++step)
+                {
+                        const size_t index = rng() % model.size();
+                        tree.Remove(Find(tree, model[index].id));
+                        model[index] = model.back();
+                        model.pop_back();
+                }
+                CheckQueries(tree, model, rng);
+        }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+TEST(LinearQueriesMatchBruteForce)
+{
+        std::mt19937 rng(30);
+        orc::LinearQuadTree<Point> tree(orc::AABB(vec2(0.0f, 0.0f), vec2(1024.0f, 1024.0f)), 8);
+        Exercise(tree, rng);
+
+        // An empty build keeps the region and the tree keeps working from there
+        std::vector<Point> none;
+        const orc::AABB region = tree.Region();
+        tree.Build(none.begin(), none.end());
+        CHECK(tree.Size() == 0 && tree.Query(region).empty());
+        CHECK(tree.Region().BottomLeft() == region.BottomLeft() && tree.Region().TopRight() == region.TopRight());
+
+        Point point = {region.Center(), 7};
+        tree.Insert(point);
+        CHECK(Ids(tree.Query(region)) == std::vector<unsigned int>(1, 7));
+}
+
+TEST(LinearTreeUsesItsAllocator)
+{
+        std::mt19937 rng(31);
+        orc::MemoryPool* pool = orc::MakeMemoryPool(4096);
+        {
+                orc::SmartPoolAllocator<Point> allocator(pool);
+                orc::LinearQuadTree<Point, orc::SmartPoolAllocator<Point>> tree(orc::AABB(vec2(0.0f, 0.0f), vec2(1024.0f, 1024.0f)), allocator, 4);
+                Exercise(tree, rng);
+        }
+        CHECK(orc::GetPoolStats(pool).bytes_in_use == 0);
+        orc::DestroyMemoryPool(pool);
+}
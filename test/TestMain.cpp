@@ -0,0 +1,22 @@
+#include "Test.h"
+
+#include <cstring>
+
+// Runs every registered case, or only those whose name contains the first argument
+int main(int argc, char** argv)
+{
+        const char* filter = argc > 1 ? argv[1] : "";
+        size_t ran = 0;
+        for (const test::TestCase& entry : test::Registry())
+        {
+                if (std::strstr(entry.name, filter) == nullptr) continue;
+
+                size_t before = test::Failures();
+                entry.function();
+                std::printf("%s %s\n", test::Failures() == before ? "[pass]" : "[FAIL]", entry.name);
+                ++ran;
+        }
+
+        std::printf("%llu cases, %llu failed checks\n", (unsigned long long) ran, (unsigned long long) test::Failures());
+        return test::Failures() == 0 && ran > 0 ? 0 : 1;
+}
@@ -0,0 +1,561 @@
+#include "Test.h"
+#include "../src/QuadTree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <mutex>
+
+using test::Point;
+
+namespace
+{
+        struct SoaTraits : orc::QuadTreeTraits
+        {
+                static const bool soa_leaves = true;
+        };
+
+        struct SumTraits : orc::QuadTreeTraits
+        {
+                typedef orc::PositionSum aggregate_policy;
+        };
+
+        struct CountingTraits : orc::QuadTreeTraits
+        {
+                static const bool count_queries = true;
+        };
+
+        template <typename pointer_range>
+        std::vector<unsigned int> Ids(const pointer_range& items)
+        {
+                std::vector<unsigned int> ids;
+                for (auto item : items) ids.push_back(item->id);
+                std::sort(ids.begin(), ids.end());
+                return ids;
+        }
+
+        // Elements of the model accepted by the predicate, the model holds the live elements only
+        template <typename predicate_type>
+        std::vector<unsigned int> BruteForce(const std::vector<Point>& model, predicate_type predicate)
+        {
+                std::vector<unsigned int> ids;
+                for (const Point& point : model)
+                {
+                        if (predicate(point.position)) ids.push_back(point.id);
+                }
+                std::sort(ids.begin(), ids.end());
+                return ids;
+        }
+
+        // Random points plus points on a coarse grid, many of them exactly on node boundaries, and a stack of duplicates
+        std::vector<Point> Scene(std::mt19937& rng, size_t count)
+        {
+                std::vector<Point> points = test::RandomPoints(rng, count, 0.0f, 1024.0f);
+                for (size_t k = 0; k < count / 4; ++k)
+                {
+                        Point point = {vec2(64.0f * (rng() % 17), 64.0f * (rng() % 17)), static_cast<unsigned int>(points.size())};
+                        points.push_back(point);
+                }
+                for (size_t k = 0; k < 40; ++k)
+                {
+                        Point point = {vec2(300.0f, 700.0f), static_cast<unsigned int>(points.size())};
+                        points.push_back(point);
+                }
+                return points;
+        }
+
+        template <typename tree_type>
+        void CheckRegions(const tree_type& tree, const std::vector<Point>& model, std::mt19937& rng, size_t queries)
+        {
+                for (size_t q = 0; q < queries; ++q)
+                {
+                        const orc::AABB box = test::RandomBox(rng, -100.0f, 1024.0f, 500.0f);
+                        const std::vector<unsigned int> expected = BruteForce(model, [&box](const vec2& p) { return box.Inside(p); });
+
+                        CHECK(Ids(tree.Query(box)) == expected);
+                        CHECK(tree.Count(box) == expected.size());
+
+                        std::vector<Point*> out;
+                        tree.Query(box, std::back_inserter(out));
+                        CHECK(Ids(out) == expected);
+
+                        std::vector<Point*> buffer(8);
+                        CHECK(tree.Query(box, buffer.data(), buffer.size()) == expected.size());
+
+                        size_t visited = 0;
+                        tree.ForEachInRegion(box, [&visited, &box](Point& point) { visited += box.Inside(point.position) ? 1 : 1000; });
+                        CHECK(visited == expected.size());
+                }
+        }
+
+        template <typename tree_type>
+        void CheckAggregates(const tree_type& tree, const std::vector<Point>& model, std::mt19937& rng, size_t queries)
+        {
+                for (size_t q = 0; q < queries; ++q)
+                {
+                        const orc::AABB box = test::RandomBox(rng, -100.0f, 1024.0f, 700.0f);
+                        double x = 0.0, y = 0.0, scale = 1.0;
+                        for (const Point& point : model)
+                        {
+                                if (!box.Inside(point.position)) continue;
+                                x += point.position.x;
+                                y += point.position.y;
+                                scale += std::fabs(point.position.x) + std::fabs(point.position.y);
+                        }
+                        const vec2 sum = tree.Aggregate(box);
+                        CHECK(std::fabs(sum.x - x) <= 1e-4 * scale && std::fabs(sum.y - y) <= 1e-4 * scale);
+                }
+        }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+TEST(RegionQueriesMatchBruteForce)
+{
+        std::mt19937 rng(1);
+        const std::vector<Point> points = Scene(rng, 4000);
+
+        orc::QuadTree<Point> incremental(orc::AABB(vec2(0.0f, 0.0f), vec2(1024.0f, 1024.0f)), 6);
+        for (const Point& point : points) incremental.Insert(point);
+        CHECK(incremental.Size() == points.size());
+        CheckRegions(incremental, points, rng, 200);
+
+        orc::QuadTree<Point> bulk(points.begin(), points.end(), 6);
+        CheckRegions(bulk, points, rng, 200);
+
+        orc::QuadTree<Point, std::allocator<Point>, SoaTraits> soa(orc::AABB(vec2(0.0f, 0.0f), vec2(1.0f, 1.0f)), 16);
+        for (const Point& point : points) soa.Insert(point); // grows the region from a tiny one
+        CheckRegions(soa, points, rng, 200);
+}
+
+TEST(CountAndAggregateFollowUpdates)
+{
+        std::mt19937 rng(2);
+        std::vector<Point> points = Scene(rng, 3000);
+        orc::QuadTree<Point, std::allocator<Point>, SumTraits> tree(orc::AABB(vec2(0.0f, 0.0f), vec2(1024.0f, 1024.0f)), 8);
+        std::vector<orc::QuadTreeHandle> handles;
+        for (const Point& point : points) handles.push_back(tree.Insert(point));
+
+        std::vector<Point> model = points;
+        CheckAggregates(tree, model, rng, 100);
+        CheckRegions(tree, model, rng, 50);
+
+        // Remove a third, move a third one by one and the rest in a batch
+        std::vector<Point> live;
+        std::vector<orc::QuadTreeHandle> batch;
+        std::vector<vec2> targets;
+        for (size_t k = 0; k < points.size(); ++k)
+        {
+                Point point = points[k];
+                switch (k % 3)
+                {
+                case 0:
+                        tree.Remove(handles[k]);
+                        continue;
+                case 1:
+                        point.position = vec2(test::Random(rng, 0.0f, 1024.0f), test::Random(rng, 0.0f, 1024.0f));
+                        tree.Move(handles[k], point.position);
+                        break;
+                case 2:
+                        point.position += vec2(test::Random(rng, -40.0f, 40.0f), test::Random(rng, -40.0f, 40.0f));
+                        batch.push_back(handles[k]);
+                        targets.push_back(point.position);
+                        break;
+                }
+                live.push_back(point);
+        }
+        tree.MoveAll(batch.data(), targets.data(), batch.size());
+        CHECK(tree.Size() == live.size());
+        CheckAggregates(tree, live, rng, 100);
+        CheckRegions(tree, live, rng, 50);
+
+        tree.Build(points.begin(), points.end());
+        CheckAggregates(tree, points, rng, 50);
+
+        std::vector<Point> many = test::RandomPoints(rng, 20000, 0.0f, 1024.0f);
+        orc::ThreadPool pool(2);
+        tree.ParallelBuild(many.begin(), many.end(), pool);
+        CheckAggregates(tree, many, rng, 50);
+        CheckRegions(tree, many, rng, 20);
+}
+
+TEST(ShapeQueriesMatchBruteForce)
+{
+        std::mt19937 rng(3);
+        const std::vector<Point> points = Scene(rng, 4000);
+        orc::QuadTree<Point> tree(points.begin(), points.end(), 8);
+
+        for (size_t q = 0; q < 100; ++q)
+        {
+                const vec2 center(test::Random(rng, 0.0f, 1024.0f), test::Random(rng, 0.0f, 1024.0f));
+                const float radius = test::Random(rng, 1.0f, 300.0f);
+                const float angle = test::Random(rng, 0.0f, 6.2831853f);
+
+                const orc::Circle circle(center, radius);
+                CHECK(Ids(tree.QueryShape(circle)) == BruteForce(points, [&circle](const vec2& p) { return circle.Inside(p); }));
+
+                const orc::OrientedBox box(center, vec2(radius, 0.3f * radius), angle);
+                CHECK(Ids(tree.QueryShape(box)) == BruteForce(points, [&box](const vec2& p) { return box.Inside(p); }));
+
+                std::vector<vec2> corners;
+                const size_t sides = 3 + q % 6;
+                for (size_t k = 0; k < sides; ++k)
+                {
+                        const float a = angle + 6.2831853f * k / sides;
+                        corners.push_back(center + vec2(radius * std::cos(a), radius * std::sin(a)));
+                }
+                if (q % 2) std::reverse(corners.begin(), corners.end());
+                const orc::ConvexPolygon polygon(corners.data(), corners.size());
+                CHECK(Ids(tree.QueryShape(polygon)) == BruteForce(points, [&polygon](const vec2& p) { return polygon.Inside(p); }));
+        }
+}
+
+TEST(NearestMatchesBruteForce)
+{
+        std::mt19937 rng(4);
+        const std::vector<Point> points = test::RandomPoints(rng, 3000, 0.0f, 1024.0f);
+        orc::QuadTree<Point> tree(points.begin(), points.end(), 8);
+
+        for (size_t q = 0; q < 100; ++q)
+        {
+                const vec2 center(test::Random(rng, -100.0f, 1100.0f), test::Random(rng, -100.0f, 1100.0f));
+                std::vector<float> distances;
+                for (const Point& point : points)
+                {
+                        const vec2 d = point.position - center;
+                        distances.push_back(d.x * d.x + d.y * d.y);
+                }
+                std::sort(distances.begin(), distances.end());
+
+                const size_t k = 1 + q % 20;
+                const std::vector<Point*> nearest = tree.Nearest(center, k);
+                CHECK(nearest.size() == k);
+                for (size_t n = 0; n < nearest.size(); ++n)
+                {
+                        const vec2 d = nearest[n]->position - center;
+                        CHECK(d.x * d.x + d.y * d.y == distances[n]);
+                }
+
+                const float radius = 30.0f;
+                const size_t within = std::upper_bound(distances.begin(), distances.end(), radius * radius) - distances.begin();
+                CHECK(tree.NearestWithin(center, radius).size() == within);
+        }
+
+        // A negative radius isn't squared into a positive one
+        CHECK(tree.NearestWithin(points[0].position, -30.0f).empty());
+}
+
+TEST(BatchAndParallelQueriesMatchQuery)
+{
+        std::mt19937 rng(5);
+        const std::vector<Point> points = Scene(rng, 30000);
+        orc::QuadTree<Point> tree(points.begin(), points.end(), 8);
+        orc::ThreadPool pool(3);
+
+        std::vector<orc::AABB> boxes;
+        for (size_t q = 0; q < 200; ++q) boxes.push_back(test::RandomBox(rng, -100.0f, 1024.0f, 400.0f));
+
+        std::vector<size_t> offsets;
+        std::vector<Point*> results;
+        tree.QueryBatch(boxes.data(), boxes.size(), offsets, results);
+        CHECK(offsets.size() == boxes.size() + 1);
+
+        for (size_t q = 0; q < boxes.size() && offsets.size() == boxes.size() + 1; ++q)
+        {
+                const std::vector<unsigned int> expected = Ids(tree.Query(boxes[q]));
+                std::vector<Point*> batch(results.begin() + offsets[q], results.begin() + offsets[q + 1]);
+                CHECK(Ids(batch) == expected);
+                if (q % 10 == 0) CHECK(Ids(tree.ParallelQuery(boxes[q], pool)) == expected);
+        }
+}
+
+TEST(ParallelForEachMatchesQuery)
+{
+        std::mt19937 rng(9);
+        const std::vector<Point> points = Scene(rng, 30000);
+        orc::QuadTree<Point> tree(points.begin(), points.end(), 8);
+        orc::ThreadPool pool(3);
+
+        // The whole root, a box around it, random boxes and a box away from every element
+        std::vector<orc::AABB> boxes;
+        boxes.push_back(tree.Region());
+        boxes.push_back(orc::AABB(tree.Region().BottomLeft() - vec2(10.0f, 10.0f), tree.Region().TopRight() + vec2(10.0f, 10.0f)));
+        for (size_t q = 0; q < 30; ++q) boxes.push_back(test::RandomBox(rng, -100.0f, 1024.0f, 600.0f));
+        boxes.push_back(orc::AABB(vec2(2000.0f, 2000.0f), vec2(2100.0f, 2100.0f)));
+
+        for (const orc::AABB& box : boxes)
+        {
+                std::mutex lock;
+                std::vector<Point*> found;
+                std::atomic<size_t> calls(0);
+                tree.ParallelForEachInRegion(box, pool, [&](Point& point)
+                {
+                        ++calls;
+                        std::lock_guard<std::mutex> guard(lock);
+                        found.push_back(&point);
+                });
+
+                // Same elements, each one exactly once
+                std::vector<Point*> expected = tree.Query(box);
+                std::sort(expected.begin(), expected.end());
+                std::sort(found.begin(), found.end());
+                CHECK(found == expected);
+                CHECK(calls == expected.size());
+        }
+}
+
+TEST(PublishedSnapshotsKeepTheirContents)
+{
+        std::mt19937 rng(6);
+        std::vector<Point> points = Scene(rng, 3000);
+        orc::QuadTree<Point> tree(orc::AABB(vec2(0.0f, 0.0f), vec2(1024.0f, 1024.0f)), 8);
+        std::vector<orc::QuadTreeHandle> handles;
+        for (const Point& point : points) handles.push_back(tree.Insert(point));
+
+        tree.Publish();
+        auto before = tree.Acquire();
+        for (size_t k = 0; k < handles.size(); k += 2) tree.Remove(handles[k]);
+        tree.Publish();
+        auto after = tree.Acquire();
+        tree.Publish(); // must not recycle either snapshot while they're held
+
+        CHECK(before->Size() == points.size());
+        CHECK(after->Size() == tree.Size());
+        for (size_t q = 0; q < 50; ++q)
+        {
+                const orc::AABB box = test::RandomBox(rng, -100.0f, 1024.0f, 400.0f);
+                CHECK(Ids(before->Query(box)) == BruteForce(points, [&box](const vec2& p) { return box.Inside(p); }));
+                CHECK(Ids(after->Query(box)) == Ids(tree.Query(box)));
+        }
+}
+
+TEST(PairsWithinMatchBruteForce)
+{
+        std::mt19937 rng(7);
+        std::vector<Point> points = Scene(rng, 1500);
+        orc::QuadTree<Point> tree(orc::AABB(vec2(0.0f, 0.0f), vec2(1024.0f, 1024.0f)), 6);
+        for (const Point& point : points) tree.Insert(point);
+
+        const float distances[] = {0.0f, 2.0f, 25.0f, 2000.0f};
+        for (float distance : distances)
+        {
+                std::vector<std::pair<unsigned int, unsigned int>> expected, found;
+                for (size_t i = 0; i < points.size(); ++i)
+                {
+                        for (size_t j = i + 1; j < points.size(); ++j)
+                        {
+                                const vec2 d = points[i].position - points[j].position;
+                                if (d.x * d.x + d.y * d.y <= distance * distance) expected.push_back(std::make_pair(points[i].id, points[j].id));
+                        }
+                }
+
+                tree.ForEachPairWithin(distance, [&found](Point& a, Point& b)
+                {
+                        found.push_back(std::make_pair(std::min(a.id, b.id), std::max(a.id, b.id)));
+                });
+                std::sort(expected.begin(), expected.end());
+                std::sort(found.begin(), found.end());
+                CHECK(found == expected); // also rules out duplicates and self pairs
+        }
+
+        // A negative distance isn't squared into a positive one, even the stacked duplicates aren't paired
+        size_t negative = 0;
+        tree.ForEachPairWithin(-25.0f, [&negative](Point&, Point&) { ++negative; });
+        CHECK(negative == 0);
+}
+
+TEST(JoinMatchesBruteForce)
+{
+        std::mt19937 rng(8);
+        const std::vector<Point> left = test::RandomPoints(rng, 2000, 0.0f, 1024.0f);
+        const std::vector<Point> right = test::RandomPoints(rng, 1500, 300.0f, 1400.0f);
+        orc::QuadTree<Point> a(left.begin(), left.end(), 5);
+        orc::QuadTree<Point, std::allocator<Point>, SoaTraits> b(orc::AABB(vec2(0.0f, 0.0f), vec2(50.0f, 50.0f)), 9);
+        for (const Point& point : right) b.Insert(point);
+
+        const float distances[] = {0.0f, 3.0f, 30.0f, 3000.0f};
+        for (float distance : distances)
+        {
+                std::vector<std::pair<unsigned int, unsigned int>> expected, found, reversed;
+                for (const Point& p : left)
+                {
+                        for (const Point& q : right)
+                        {
+                                const vec2 d = p.position - q.position;
+                                if (d.x * d.x + d.y * d.y <= distance * distance) expected.push_back(std::make_pair(p.id, q.id));
+                        }
+                }
+
+                orc::Join(a, b, orc::WithinDistance(distance), [&found](Point& p, Point& q) { found.push_back(std::make_pair(p.id, q.id)); });
+                b.Join(a, orc::WithinDistance(distance), [&reversed](Point& q, Point& p) { reversed.push_back(std::make_pair(p.id, q.id)); });
+                std::sort(expected.begin(), expected.end());
+                std::sort(found.begin(), found.end());
+                std::sort(reversed.begin(), reversed.end());
+                CHECK(found == expected);
+                CHECK(reversed == expected);
+        }
+}
+
+TEST(RaycastFindsTheClosestHit)
+{
+        std::mt19937 rng(9);
+        std::vector<Point> points = test::RandomPoints(rng, 5000, 0.0f, 1000.0f);
+        const unsigned int row = 100000, column = 200000, crowd = 300000;
+        for (unsigned int k = 0; k < 200; ++k)
+        {
+                Point across = {vec2(test::Random(rng, 0.0f, 1000.0f), 500.5f), row + k};
+                Point along = {vec2(250.25f, test::Random(rng, 0.0f, 1000.0f)), column + k};
+                points.push_back(across);
+                points.push_back(along);
+        }
+        for (unsigned int k = 0; k < 100; ++k)
+        {
+                Point duplicate = {vec2(700.0f, 700.0f), crowd + k};
+                points.push_back(duplicate);
+        }
+
+        orc::QuadTree<Point> tree(orc::AABB(vec2(0.0f, 0.0f), vec2(1000.0f, 1000.0f)), 4);
+        for (const Point& point : points) tree.Insert(point);
+
+        // Rays running along the lines of points, the first hit on the line must be the closest one
+        for (unsigned int q = 0; q < 200; ++q)
+        {
+                const bool horizontal = q % 2 == 1;
+                const float sign = (q / 2) % 2 == 1 ? 1.0f : -1.0f;
+                const float start = test::Random(rng, 0.0f, 1000.0f);
+                const float max_distance = test::Random(rng, 0.0f, 1000.0f);
+                const vec2 origin = horizontal ? vec2(start, 500.5f) : vec2(250.25f, start);
+                const vec2 direction = horizontal ? vec2(sign * 3.0f, 0.0f) : vec2(0.0f, sign * 0.5f);
+                const unsigned int first = horizontal ? row : column;
+                auto on_line = [first](const Point& point) { return point.id >= first && point.id < first + 200; };
+
+                float best = -1.0f;
+                for (const Point& point : points)
+                {
+                        const float along = horizontal ? (point.position.x - origin.x) * sign : (point.position.y - origin.y) * sign;
+                        if (on_line(point) && along >= 0.0f && along <= max_distance && (best < 0.0f || along < best)) best = along;
+                }
+
+                std::vector<unsigned int> offered;
+                bool in_range = true;
+                tree.Raycast(origin, direction, max_distance, [&](Point& point, float distance)
+                {
+                        offered.push_back(point.id);
+                        in_range = in_range && distance >= 0.0f && distance <= max_distance;
+                        return false;
+                });
+                std::sort(offered.begin(), offered.end());
+                CHECK(std::adjacent_find(offered.begin(), offered.end()) == offered.end());
+                CHECK(in_range);
+
+                float found = -1.0f;
+                const bool hit = tree.Raycast(origin, direction, max_distance, [&](Point& point, float distance)
+                {
+                        if (!on_line(point)) return false;
+                        found = distance;
+                        return true;
+                });
+                CHECK(hit == (best >= 0.0f));
+                CHECK(!hit || std::fabs(found - best) < 1e-3f);
+        }
+
+        // Random rays must offer every element lying on them
+        for (unsigned int q = 0; q < 200; ++q)
+        {
+                const vec2 origin(test::Random(rng, 0.0f, 1000.0f), test::Random(rng, 0.0f, 1000.0f));
+                const float angle = test::Random(rng, 0.0f, 6.2831853f);
+                const vec2 unit(std::cos(angle), std::sin(angle));
+                const float max_distance = test::Random(rng, 0.0f, 1000.0f);
+
+                std::vector<unsigned int> offered;
+                tree.Raycast(origin, unit * 7.0f, max_distance, [&offered](Point& point, float) { offered.push_back(point.id); return false; });
+                std::sort(offered.begin(), offered.end());
+                for (const Point& point : points)
+                {
+                        const vec2 offset = point.position - origin;
+                        const float along = offset.x * unit.x + offset.y * unit.y;
+                        const float across = std::fabs(offset.x * unit.y - offset.y * unit.x);
+                        if (along >= 0.01f && along <= max_distance - 0.01f && across < 1e-4f)
+                                CHECK(std::binary_search(offered.begin(), offered.end(), point.id));
+                }
+        }
+
+        // A leaf holding more elements than its capacity, and a ray starting outside of the region
+        CHECK(tree.SegmentCast(vec2(0.0f, 700.0f), vec2(1000.0f, 700.0f), [crowd](Point& point, float) { return point.id >= crowd; }));
+        size_t crossed = 0;
+        tree.Raycast(vec2(-100.0f, 500.5f), vec2(1.0f, 0.0f), 2000.0f, [&crossed, row](Point& point, float)
+        {
+                if (point.id >= row && point.id < row + 200) ++crossed;
+                return false;
+        });
+        CHECK(crossed == 200);
+}
+
+TEST(StatsDescribeTheTree)
+{
+        // Two points in the south west quadrant split the root when the fourth one comes in, the fifth lands in the south east
+        const vec2 positions[] = {vec2(10.0f, 10.0f), vec2(20.0f, 20.0f), vec2(80.0f, 80.0f), vec2(90.0f, 90.0f), vec2(60.0f, 10.0f)};
+        orc::QuadTree<Point> tree(orc::AABB(vec2(0.0f, 0.0f), vec2(100.0f, 100.0f)), 4);
+        for (unsigned int k = 0; k < 5; ++k)
+        {
+                Point point = {positions[k], k};
+                tree.Insert(point);
+        }
+
+        orc::QuadTreeStats stats = tree.Stats();
+        CHECK(stats.nodes == 5 && stats.leaves == 4 && stats.elements == 5);
+        CHECK(stats.depth == 1);
+        CHECK(stats.depth_histogram == std::vector<size_t>({0, 4}));
+        const size_t occupancy[11] = {1, 0, 1, 0, 0, 2, 0, 0, 0, 0, 0}; // sizes 2, 0, 1 and 2 out of 4
+        CHECK(std::equal(occupancy, occupancy + 11, stats.occupancy_histogram));
+        CHECK(stats.overflow_leaves == 0);
+
+        // Duplicates split the tree all the way down to max_depth, where the last leaf has to grow past the capacity
+        orc::QuadTree<Point> stacked(orc::AABB(vec2(0.0f, 0.0f), vec2(100.0f, 100.0f)), 4);
+        for (unsigned int k = 0; k < 40; ++k)
+        {
+                Point point = {vec2(10.0f, 10.0f), k};
+                stacked.Insert(point);
+        }
+        stats = stacked.Stats();
+        CHECK(stats.nodes == 1 + 4 * 16 && stats.leaves == 3 * 16 + 1 && stats.elements == 40);
+        CHECK(stats.depth == 16 && stats.depth_histogram.size() == 17);
+        CHECK(stats.depth_histogram[0] == 0 && stats.depth_histogram[16] == 4);
+        for (size_t depth = 1; depth < 16 && stats.depth_histogram.size() == 17; ++depth) CHECK(stats.depth_histogram[depth] == 3);
+        CHECK(stats.occupancy_histogram[0] == 3 * 16 && stats.occupancy_histogram[10] == 1);
+        CHECK(stats.overflow_leaves == 1);
+        CHECK(stats.bytes > tree.Stats().bytes);
+}
+
+TEST(QueryCountersFollowTheTraversal)
+{
+        const vec2 positions[] = {vec2(10.0f, 10.0f), vec2(20.0f, 20.0f), vec2(80.0f, 80.0f), vec2(90.0f, 90.0f), vec2(60.0f, 10.0f)};
+        orc::QuadTree<Point, std::allocator<Point>, CountingTraits> counted(orc::AABB(vec2(0.0f, 0.0f), vec2(100.0f, 100.0f)), 4);
+        orc::QuadTree<Point> plain(orc::AABB(vec2(0.0f, 0.0f), vec2(100.0f, 100.0f)), 4);
+        for (unsigned int k = 0; k < 5; ++k)
+        {
+                Point point = {positions[k], k};
+                counted.Insert(point);
+                plain.Insert(point);
+        }
+
+        // The root is accepted whole, its elements are emitted without being tested
+        CHECK(counted.Query(counted.Region()).size() == 5);
+        orc::QueryStats counters = counted.QueryCounters();
+        CHECK(counters.nodes_visited == 1 && counters.leaves_scanned == 0 && counters.points_tested == 0 && counters.points_emitted == 5);
+
+        // Only the south west leaf intersects, both of its points are tested
+        CHECK(counted.Query(orc::AABB(vec2(0.0f, 0.0f), vec2(15.0f, 15.0f))).size() == 1);
+        counters = counted.QueryCounters();
+        CHECK(counters.nodes_visited == 3 && counters.leaves_scanned == 1 && counters.points_tested == 2 && counters.points_emitted == 6);
+
+        counted.ResetQueryCounters();
+        counters = counted.QueryCounters();
+        CHECK(counters.nodes_visited == 0 && counters.leaves_scanned == 0 && counters.points_tested == 0 && counters.points_emitted == 0);
+
+        // The default traits compile the counting out
+        CHECK(plain.Query(plain.Region()).size() == 5);
+        CHECK(plain.Query(orc::AABB(vec2(0.0f, 0.0f), vec2(15.0f, 15.0f))).size() == 1);
+        counters = plain.QueryCounters();
+        CHECK(counters.nodes_visited == 0 && counters.leaves_scanned == 0 && counters.points_tested == 0 && counters.points_emitted == 0);
+}
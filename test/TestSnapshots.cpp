@@ -0,0 +1,127 @@
+#include "Test.h"
+#include "../src/QuadTree.h"
+
+#include <algorithm>
+#include <thread>
+
+using test::Point;
+
+namespace
+{
+        const unsigned int still_count = 3000;
+        const unsigned int moving_count = 300;
+
+        // Elements below still_count never move, the others are all shifted by the same offset before each publish
+        vec2 Home(unsigned int id)
+        {
+                return vec2(static_cast<float>(id % 61) * 16.0f + 8.0f, static_cast<float>(id / 61) * 16.0f + 8.0f);
+        }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+TEST(PublishSharesUnchangedSubtrees)
+{
+        orc::QuadTree<Point> tree(orc::AABB(vec2(0.0f, 0.0f), vec2(1024.0f, 1024.0f)), 8);
+        std::vector<orc::QuadTreeHandle> handles;
+        for (unsigned int k = 0; k < still_count; ++k)
+        {
+                Point point = {Home(k), k};
+                handles.push_back(tree.Insert(point));
+        }
+
+        CHECK(!tree.Acquire());
+        tree.Publish();
+        auto before = tree.Acquire();
+
+        // A change in one corner leaves the elements of the opposite corner where they were
+        tree.Move(handles[0], vec2(20.0f, 20.0f));
+        tree.Publish();
+        auto after = tree.Acquire();
+
+        const orc::AABB corner(vec2(900.0f, 0.0f), vec2(1024.0f, 100.0f));
+        const std::vector<const Point*> old_corner = before->Query(corner);
+        CHECK(!old_corner.empty());
+        CHECK(old_corner == after->Query(corner));
+        CHECK(before->Query(orc::AABB(vec2(19.0f, 19.0f), vec2(21.0f, 21.0f))).empty());
+        CHECK(after->Query(orc::AABB(vec2(19.0f, 19.0f), vec2(21.0f, 21.0f))).size() == 1);
+
+        size_t leaves = 0;
+        after->ForEachLeaf([&leaves](const orc::AABB&) { ++leaves; });
+        CHECK(leaves == tree.Stats().leaves);
+
+        // Bulk loading replaces every piece
+        std::vector<Point> points;
+        for (unsigned int k = 0; k < still_count; ++k)
+        {
+                Point point = {Home(k) + vec2(1.0f, 1.0f), k};
+                points.push_back(point);
+        }
+        tree.Build(points.begin(), points.end());
+        tree.Publish();
+        auto rebuilt = tree.Acquire();
+        CHECK(rebuilt->Size() == still_count);
+        const std::vector<const Point*> new_corner = rebuilt->Query(corner);
+        CHECK(new_corner.size() == old_corner.size());
+        for (const Point* point : new_corner) CHECK(point->position == Home(point->id) + vec2(1.0f, 1.0f));
+}
+
+TEST(ReadersSeeWholePublishes)
+{
+        orc::QuadTree<Point> tree(orc::AABB(vec2(0.0f, 0.0f), vec2(1024.0f, 1024.0f)), 8);
+        std::vector<orc::QuadTreeHandle> moving;
+        for (unsigned int k = 0; k < still_count + moving_count; ++k)
+        {
+                Point point = {Home(k), k};
+                orc::QuadTreeHandle handle = tree.Insert(point);
+                if (k >= still_count) moving.push_back(handle);
+        }
+        tree.Publish();
+
+        // The writer shifts the moving elements as a whole, half of them one at a time and half in a batch, then publishes
+        std::atomic<bool> done(false);
+        std::thread writer([&]()
+        {
+                std::vector<vec2> targets(moving_count / 2);
+                for (unsigned int round = 1; round <= 300; ++round)
+                {
+                        const vec2 shift(static_cast<float>(round % 50), static_cast<float>((round * 7) % 50));
+                        for (unsigned int k = 0; k < moving_count / 2; ++k) tree.Move(moving[k], Home(still_count + k) + shift);
+                        for (unsigned int k = 0; k < moving_count / 2; ++k) targets[k] = Home(still_count + moving_count / 2 + k) + shift;
+                        tree.MoveAll(moving.data() + moving_count / 2, targets.data(), targets.size());
+                        tree.Publish();
+                }
+                done = true;
+        });
+
+        std::vector<std::thread> readers;
+        std::atomic<size_t> torn(0), reads(0);
+        for (unsigned int r = 0; r < 3; ++r)
+        {
+                readers.emplace_back([&]()
+                {
+                        do
+                        {
+                                auto snapshot = tree.Acquire();
+                                bool first = true, whole = snapshot->Size() == still_count + moving_count;
+                                vec2 shift;
+                                size_t seen = 0;
+                                snapshot->ForEachInRegion(snapshot->Region(), [&](const Point& point)
+                                {
+                                        ++seen;
+                                        const vec2 offset = point.position - Home(point.id);
+                                        if (point.id < still_count) whole = whole && offset == vec2(0.0f, 0.0f);
+                                        else if (first) shift = offset, first = false;
+                                        else whole = whole && offset == shift;
+                                });
+                                if (!whole || seen != still_count + moving_count) ++torn;
+                                ++reads;
+                        } while (!done);
+                });
+        }
+
+        writer.join();
+        for (std::thread& reader : readers) reader.join();
+        CHECK(torn == 0);
+        CHECK(reads > 0);
+}
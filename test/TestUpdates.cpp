@@ -0,0 +1,146 @@
+#include "Test.h"
+#include "../src/QuadTree.h"
+
+#include <algorithm>
+
+using test::Point;
+
+namespace
+{
+        std::vector<unsigned int> Ids(const std::vector<Point*>& items)
+        {
+                std::vector<unsigned int> ids;
+                for (const Point* item : items) ids.push_back(item->id);
+                std::sort(ids.begin(), ids.end());
+                return ids;
+        }
+
+        std::vector<unsigned int> Ids(const std::vector<Point>& model)
+        {
+                std::vector<unsigned int> ids;
+                for (const Point& point : model) ids.push_back(point.id);
+                std::sort(ids.begin(), ids.end());
+                return ids;
+        }
+
+        // Every handle must lead to its element, and every element must be found by a query around it and by a query of the whole region
+        void CheckModel(const orc::QuadTree<Point>& tree, const std::vector<orc::QuadTreeHandle>& handles, const std::vector<Point>& model)
+        {
+                CHECK(tree.Size() == model.size());
+                CHECK(Ids(tree.Query(tree.Region())) == Ids(model));
+                for (size_t k = 0; k < model.size(); ++k)
+                {
+                        const Point* item = tree.Get(handles[k]);
+                        CHECK(item != nullptr && item->id == model[k].id && item->position == model[k].position);
+
+                        const vec2 point = model[k].position;
+                        const std::vector<Point*> around = tree.Query(orc::AABB(point - vec2(0.5f, 0.5f), point + vec2(0.5f, 0.5f)));
+                        CHECK(std::find(around.begin(), around.end(), item) != around.end());
+                }
+        }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+TEST(MoveOutsideTheRegionGrowsIt)
+{
+        std::mt19937 rng(10);
+        std::vector<Point> model = test::RandomPoints(rng, 20, 0.0f, 100.0f);
+        orc::QuadTree<Point> tree(orc::AABB(vec2(0.0f, 0.0f), vec2(100.0f, 100.0f)), 4);
+        std::vector<orc::QuadTreeHandle> handles;
+        for (const Point& point : model) handles.push_back(tree.Insert(point));
+
+        const vec2 targets[] = {vec2(150.0f, 150.0f), vec2(-420.0f, 30.0f), vec2(50.0f, 50.0f), vec2(100.0f, -1000.0f)};
+        for (const vec2& target : targets)
+        {
+                Point* moved = tree.Move(handles[3], target);
+                model[3].position = target;
+                CHECK(moved != nullptr && moved == tree.Get(handles[3]));
+                CHECK(tree.Region().Inside(target));
+                CheckModel(tree, handles, model);
+        }
+
+        // The same through a batch, including elements that only move inside the region
+        std::vector<vec2> positions;
+        for (size_t k = 0; k < model.size(); ++k)
+        {
+                model[k].position = k % 3 == 0 ? vec2(test::Random(rng, 2000.0f, 3000.0f), test::Random(rng, -3000.0f, -2000.0f)) : model[k].position + vec2(1.0f, 1.0f);
+                positions.push_back(model[k].position);
+        }
+        tree.MoveAll(handles.data(), positions.data(), handles.size());
+        CheckModel(tree, handles, model);
+}
+
+TEST(MoveOutsideARootLeaf)
+{
+        std::vector<Point> model;
+        for (unsigned int k = 0; k < 3; ++k)
+        {
+                Point point = {vec2(10.0f * k, 10.0f * k), k};
+                model.push_back(point);
+        }
+        orc::QuadTree<Point> tree(orc::AABB(vec2(0.0f, 0.0f), vec2(100.0f, 100.0f)), 4);
+        std::vector<orc::QuadTreeHandle> handles;
+        for (const Point& point : model) handles.push_back(tree.Insert(point));
+
+        // The root is still a leaf, growing the region moves its elements down a level
+        tree.Move(handles[1], vec2(-250.0f, 400.0f));
+        model[1].position = vec2(-250.0f, 400.0f);
+        CheckModel(tree, handles, model);
+
+        const vec2 back[] = {vec2(5.0f, 5.0f), vec2(-250.0f, 400.0f), vec2(90.0f, 90.0f)};
+        tree.MoveAll(handles.data(), back, handles.size());
+        for (size_t k = 0; k < model.size(); ++k) model[k].position = back[k];
+        CheckModel(tree, handles, model);
+}
+
+TEST(PointerUpdatesOnLeafBoundaries)
+{
+        std::mt19937 rng(11);
+        orc::QuadTree<Point> tree(orc::AABB(vec2(0.0f, 0.0f), vec2(100.0f, 100.0f)), 4);
+        std::vector<Point> model;
+        std::vector<orc::QuadTreeHandle> handles;
+        for (unsigned int k = 0; k < 200; ++k)
+        {
+                Point point = {vec2(test::Random(rng, 0.0f, 100.0f), test::Random(rng, 0.0f, 100.0f)), k};
+                model.push_back(point);
+                handles.push_back(tree.Insert(point));
+        }
+
+        // Moving onto the center lines keeps the elements in leaves the partition rule would send the other way
+        for (size_t k = 0; k < model.size(); ++k)
+        {
+                const vec2 point = model[k].position;
+                const float cx = point.x > 50.0f ? 50.0f + 25.0f * (point.x > 75.0f) : 25.0f * (point.x > 25.0f);
+                const float cy = point.y > 50.0f ? 50.0f + 25.0f * (point.y > 75.0f) : 25.0f * (point.y > 25.0f);
+                model[k].position = k % 3 == 0 ? vec2(cx, point.y) : k % 3 == 1 ? vec2(point.x, cy) : vec2(cx, cy);
+                tree.Move(handles[k], model[k].position);
+        }
+        CheckModel(tree, handles, model);
+
+        // Then update them through their pointers, along the boundary, across the tree and outside of the region
+        for (size_t k = 0; k < model.size(); k += 4)
+        {
+                const vec2 targets[] = {model[k].position + vec2(0.0f, 1.0f), vec2(100.0f - model[k].position.x, model[k].position.y), vec2(-50.0f, 150.0f)};
+                model[k].position = targets[(k / 4) % 3];
+                Point* moved = tree.Move(tree.Get(handles[k]), model[k].position);
+                CHECK(moved != nullptr && moved == tree.Get(handles[k]));
+        }
+        CheckModel(tree, handles, model);
+
+        for (size_t k = model.size(); k-- > 0;)
+        {
+                if (k % 2 == 0) continue;
+                tree.Remove(tree.Get(handles[k]));
+                CHECK(tree.Get(handles[k]) == nullptr);
+                model.erase(model.begin() + k);
+                handles.erase(handles.begin() + k);
+        }
+        CheckModel(tree, handles, model);
+
+        // Pointers to elements no longer in the tree are ignored
+        Point outside = {vec2(50.0f, 50.0f), 1000};
+        tree.Remove(&outside);
+        CHECK(tree.Move(&outside, vec2(10.0f, 10.0f)) == nullptr);
+        CheckModel(tree, handles, model);
+}